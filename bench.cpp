@@ -0,0 +1,639 @@
+// THE BENCHMARK
+//
+// "make bench" builds this and runs it from the source directory.  It
+// generates a few corpora in bench-data/, each from a fixed seed so
+// every run and every machine sees the same bytes, then compresses and
+// decompresses each of them with ./crook at a few settings and prints
+// a table with the compression ratio, the speeds, the wall-clock times
+// and the peak memory of each run.  Every round trip is checked.
+//
+// The corpora are synthetic stand-ins for the kinds of data crook is
+// meant for:
+//
+// - text:   words from a Zipf-distributed vocabulary, each followed by
+//           one of a few likely successors, with punctuation and lines
+// - log:    server log lines from a handful of templates with
+//           increasing timestamps, addresses and ids
+// - table:  32-byte binary records with counters, slowly drifting
+//           values and names from a small set
+// - random: incompressible bytes
+// - repeat: 16 KiB chunks of random 7-bit bytes repeated in random
+//           order with a few bytes changed, i.e. long matches far apart
+// - copies: copies of 512 KiB of random bytes, like the same JPEG or
+//           .gz file backed up again and again; stored at disk speed
+//           by default, what already compressed data costs the second
+//           time with -n
+//
+// Each run is a fork and exec of crook, timed with the monotonic clock;
+// wait4 gives its peak resident set size.  The last argument, if any,
+// is the size of each corpus in MiB (default: 4).  Existing corpora of
+// the right size are reused.  Their file names carry the seed and the
+// version of their generator, e.g. bench-data/text-1-v1, and a generator
+// that's changed must get a new version so its old output isn't.
+//
+// BASELINES
+//
+// To keep a slower or worse crook from being shipped unnoticed the
+// results can be saved and later runs compared against them:
+//
+//   crook-bench -sBASE.json      run and save the results
+//   crook-bench -cBASE.json      run and compare, exit 1 on a regression
+//
+// (the file name attached to the option, as with crook's options).  A
+// comparison fails when the code of any corpus and setting grows by
+// more than BPC_TOLERANCE, or when either speed drops by more than the
+// tolerance of -tN percent (default: 5) plus twice the larger of the
+// two runs' spreads.  The spread is how far the slowest of the -rN
+// repetitions (default: 3 with -s or -c, else 1) was from the fastest,
+// which is what's reported as the time, so a noisy machine needs a
+// bigger drop to fail than a quiet one.  Runs of less than TIME_FLOOR
+// seconds in the baseline are mostly starting up crook and their
+// speeds aren't gated.  A baseline made with another corpus size can't
+// be compared against.
+//
+// The baseline is JSON with one result per line, which is also all the
+// reader here understands.
+
+#include "config.hpp"
+
+#include "getopt.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// xorshift64*: small, fast and the same everywhere
+class Random
+{
+    U64 x;
+public:
+    Random(U64 seed) : x(seed) {}
+
+    U32 Next()
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        return (x * 2685821657736338717ull) >> 32;
+    }
+
+    // uniform in 0 .. n-1
+    U32 Below(U32 n)
+    {
+        return (U64)Next() * n >> 32;
+    }
+
+    // Zipf-like in 0 .. n-1, small values being the most likely
+    U32 Skewed(U32 n)
+    {
+        return Below(Below(n) + 1);
+    }
+};
+
+// CORPORA
+
+void Text(string & out, U32 size, Random & rng)
+{
+    const int WORDS = 4096, NEXT = 8;
+    const char letters[] = "etaoinshrdlcumwfgypbvkjxqz";
+    vector<string> words(WORDS);
+    for (int i = 0; i != WORDS; ++i)
+    {
+        int length = 1 + rng.Skewed(12);
+        for (int j = 0; j != length; ++j)
+            words[i] += letters[rng.Skewed(26)];
+    }
+    vector<int> next(WORDS * NEXT);
+    for (int i = 0; i != WORDS * NEXT; ++i)
+        next[i] = rng.Skewed(WORDS);
+
+    int word = 0;
+    U32 line = 0;
+    bool capital = true;
+    while (out.size() < size)
+    {
+        word = rng.Below(8) == 0 ? rng.Skewed(WORDS)
+                                 : next[word * NEXT + rng.Skewed(NEXT)];
+        string w = words[word];
+        if (capital)
+            w[0] = w[0] - 'a' + 'A';
+        capital = false;
+        U32 r = rng.Below(16);
+        if (r == 0)
+            w += '.', capital = true;
+        else if (r == 1)
+            w += ',';
+        if (line + w.size() >= 72)
+            out += '\n', line = 0;
+        else if (line != 0)
+            out += ' ', ++line;
+        out += w;
+        line += w.size();
+    }
+}
+
+void Log(string & out, U32 size, Random & rng)
+{
+    static const char * const levels[] = { "INFO", "INFO", "INFO", "WARN", "ERROR" };
+    static const char * const users[] = { "root", "admin", "deploy", "www", "backup", "git" };
+    static const char * const paths[] = { "/", "/index.html", "/api/v1/items",
+                                          "/api/v1/users", "/static/app.js",
+                                          "/login", "/health" };
+    U64 ms = 1700000000000ull;
+    char line[256];
+    while (out.size() < size)
+    {
+        ms += rng.Skewed(2000);
+        time_t seconds = ms / 1000;
+        struct tm t;
+        gmtime_r(&seconds, &t);
+        char stamp[32];
+        strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &t);
+        int host = rng.Skewed(16);
+        const char * level = levels[rng.Below(5)];
+        switch (rng.Below(3))
+        {
+        case 0:
+            snprintf(line, sizeof line,
+                     "%s.%03dZ host-%02d sshd[%d]: %s Accepted publickey for "
+                     "%s from 10.%d.%d.%d port %d\n", stamp, (int)(ms % 1000),
+                     host, 1000 + rng.Below(30000), level,
+                     users[rng.Skewed(6)], rng.Skewed(4), rng.Below(256),
+                     rng.Below(256), 1024 + rng.Below(64000));
+            break;
+        case 1:
+            snprintf(line, sizeof line,
+                     "%s.%03dZ host-%02d nginx: %s \"GET %s HTTP/1.1\" %d %d "
+                     "%dms\n", stamp, (int)(ms % 1000), host, level,
+                     paths[rng.Skewed(7)], rng.Below(10) ? 200 : 404,
+                     rng.Skewed(100000), rng.Skewed(500));
+            break;
+        default:
+            snprintf(line, sizeof line,
+                     "%s.%03dZ host-%02d cron[%d]: %s job %d finished in %d.%03ds\n",
+                     stamp, (int)(ms % 1000), host, 1000 + rng.Below(30000),
+                     level, rng.Skewed(50), rng.Skewed(60), rng.Below(1000));
+        }
+        out += line;
+    }
+}
+
+void Table(string & out, U32 size, Random & rng)
+{
+    static const char * const names[] = { "alpha", "bravo", "charlie", "delta",
+                                          "echo", "foxtrot", "golf", "hotel" };
+    U32 id = 0, stamp = 1700000000, price = 100000;
+    while (out.size() < size)
+    {
+        U8 record[32] = { 0 };
+        stamp += rng.Skewed(60);
+        price += rng.Below(201) - 100;
+        U32 fields[4] = { id++, stamp, price, rng.Skewed(16) };
+        memcpy(record, fields, sizeof fields);
+        const char * name = names[rng.Skewed(8)];
+        memcpy(record + 16, name, strlen(name));
+        out.append((const char *)record, sizeof record);
+    }
+}
+
+void Noise(string & out, U32 size, Random & rng)
+{
+    while (out.size() < size)
+        out += (char)rng.Next();
+}
+
+void Repeat(string & out, U32 size, Random & rng)
+{
+    const U32 CHUNK = 1 << 14, CHUNKS = 32;
+    string chunks;
+    while (chunks.size() < CHUNK * CHUNKS)
+        chunks += (char)(rng.Next() & 0x7F);
+    while (out.size() < size)
+    {
+        string chunk = chunks.substr(rng.Below(CHUNKS) * CHUNK, CHUNK);
+        for (U32 i = rng.Below(4); i != 0; --i)
+            chunk[rng.Below(CHUNK)] = rng.Next() & 0x7F;
+        out += chunk;
+    }
+}
+
+void Copies(string & out, U32 size, Random & rng)
+{
+    const U32 CHUNK = 1 << 19;
+    string chunk;
+    while (chunk.size() < CHUNK)
+        chunk += (char)rng.Next();
+    while (out.size() < size)
+        out += chunk;
+}
+
+struct Corpus
+{
+    const char * name;
+    int version; // of the generator, see above
+    void (* generate)(string &, U32, Random &);
+};
+
+const Corpus corpora[] =
+{
+    { "text",   1, Text   },
+    { "log",    1, Log    },
+    { "table",  1, Table  },
+    { "random", 1, Noise  },
+    { "repeat", 1, Repeat },
+    { "copies", 1, Copies },
+};
+
+// the last one also models the blocks the default stores, see -n
+const char * const settings[] =
+{
+    "-O2 -m32", "-O4 -m128", "-O6 -m512", "-O4 -m128 -n"
+};
+
+// RUNNING CROOK
+
+struct Run
+{
+    bool ok;
+    double seconds;
+    U32 peakKiB;
+};
+
+Run Crook(const char * options, const char * command, const string & from,
+          const string & to)
+{
+    vector<string> words;
+    words.push_back("./crook");
+    words.push_back("-q"); // no progress bar or summary, just errors
+    string rest = options;
+    for (size_t i = 0; i < rest.size(); )
+    {
+        size_t j = rest.find(' ', i);
+        if (j == string::npos)
+            j = rest.size();
+        if (j != i)
+            words.push_back(rest.substr(i, j - i));
+        i = j + 1;
+    }
+    words.push_back(command);
+    words.push_back(from);
+    words.push_back(to);
+    vector<char *> argv;
+    for (size_t i = 0; i != words.size(); ++i)
+        argv.push_back(&words[i][0]);
+    argv.push_back(NULL);
+
+    Run run = { false, 0, 0 };
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (pid < 0 || wait4(pid, &status, 0, &usage) != pid)
+        return run;
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    run.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    run.seconds = (finish.tv_sec - start.tv_sec) +
+                  (finish.tv_nsec - start.tv_nsec) * 1e-9;
+    run.peakKiB = usage.ru_maxrss;
+    return run;
+}
+
+bool ReadFile(const string & path, string & data)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    data.clear();
+    char buffer[1 << 16];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof buffer, file)) != 0)
+        data.append(buffer, n);
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool WriteFile(const string & path, const string & data)
+{
+    FILE * file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    fwrite(data.data(), 1, data.size(), file);
+    return fclose(file) == 0;
+}
+
+// RESULTS
+
+const double BPC_TOLERANCE = 0.001; // relative growth of the code
+const double TIME_FLOOR = 0.1;      // seconds, shorter runs aren't gated
+
+struct Result
+{
+    string corpus, options;
+    U32 size, code;
+    double cSeconds, dSeconds; // the fastest runs
+    double cSpread, dSpread;   // (slowest - fastest) / fastest
+    U32 peakKiB;
+    bool ok;
+};
+
+// Compresses and decompresses a corpus runs times.
+Result Measure(const string & path, const string & text, const char * options,
+               int runs)
+{
+    Result result;
+    result.size = text.size();
+    result.code = 0;
+    result.ok = true;
+    result.peakKiB = 0;
+    double cWorst = 0, dWorst = 0;
+    result.cSeconds = result.dSeconds = 1e9;
+    for (int run = 0; run != runs; ++run)
+    {
+        Run c = Crook(options, "c", path, path + ".crook");
+        Run d = Crook(options, "d", path + ".crook", path + ".out");
+        string code, out;
+        result.ok = result.ok && c.ok && d.ok &&
+                    ReadFile(path + ".crook", code) &&
+                    ReadFile(path + ".out", out) && out == text;
+        result.code = code.size();
+        result.cSeconds = min(result.cSeconds, c.seconds);
+        result.dSeconds = min(result.dSeconds, d.seconds);
+        cWorst = max(cWorst, c.seconds);
+        dWorst = max(dWorst, d.seconds);
+        result.peakKiB = max(result.peakKiB, max(c.peakKiB, d.peakKiB));
+        remove((path + ".crook").c_str());
+        remove((path + ".out").c_str());
+    }
+    result.cSpread = (cWorst - result.cSeconds) / result.cSeconds;
+    result.dSpread = (dWorst - result.dSeconds) / result.dSeconds;
+    return result;
+}
+
+double Bpc(const Result & result)
+{
+    return 8.0 * result.code / result.size;
+}
+
+// speeds in MB/s
+double CSpeed(const Result & result)
+{
+    return result.size / 1e6 / result.cSeconds;
+}
+
+double DSpeed(const Result & result)
+{
+    return result.size / 1e6 / result.dSeconds;
+}
+
+bool WriteBaseline(const string & path, const vector<Result> & results)
+{
+    FILE * file = fopen(path.c_str(), "w");
+    if (file == NULL)
+        return false;
+    fprintf(file, "{\"results\": [\n");
+    for (size_t i = 0; i != results.size(); ++i)
+    {
+        const Result & r = results[i];
+        fprintf(file, "{\"corpus\": \"%s\", \"options\": \"%s\", "
+                "\"size\": %u, \"code\": %u, \"bpc\": %.4f, "
+                "\"c_seconds\": %.4f, \"d_seconds\": %.4f, "
+                "\"c_spread\": %.4f, \"d_spread\": %.4f, "
+                "\"peak_kib\": %u}%s\n",
+                r.corpus.c_str(), r.options.c_str(), r.size, r.code, Bpc(r),
+                r.cSeconds, r.dSeconds, r.cSpread, r.dSpread, r.peakKiB,
+                i + 1 != results.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    return fclose(file) == 0;
+}
+
+// The value of "key" in a line of a baseline, as written above.
+bool Field(const string & line, const char * key, string & value)
+{
+    string quoted = string("\"") + key + "\": ";
+    size_t start = line.find(quoted);
+    if (start == string::npos)
+        return false;
+    start += quoted.size();
+    if (line[start] == '"')
+    {
+        size_t end = line.find('"', start + 1);
+        if (end == string::npos)
+            return false;
+        value = line.substr(start + 1, end - start - 1);
+    }
+    else
+        value = line.substr(start, line.find_first_of(",}", start) - start);
+    return true;
+}
+
+bool ReadBaseline(const string & path, vector<Result> & results)
+{
+    string data;
+    if (!ReadFile(path, data))
+        return false;
+    for (size_t i = 0; i < data.size(); )
+    {
+        size_t end = data.find('\n', i);
+        if (end == string::npos)
+            end = data.size();
+        string line = data.substr(i, end - i);
+        i = end + 1;
+
+        Result r;
+        string size, code, c, d, cSpread, dSpread, peak;
+        if (!Field(line, "corpus", r.corpus))
+            continue;
+        if (!Field(line, "options", r.options) || !Field(line, "size", size) ||
+            !Field(line, "code", code) || !Field(line, "c_seconds", c) ||
+            !Field(line, "d_seconds", d) || !Field(line, "c_spread", cSpread) ||
+            !Field(line, "d_spread", dSpread) || !Field(line, "peak_kib", peak))
+            return false;
+        r.size = strtoul(size.c_str(), NULL, 10);
+        r.code = strtoul(code.c_str(), NULL, 10);
+        r.cSeconds = strtod(c.c_str(), NULL);
+        r.dSeconds = strtod(d.c_str(), NULL);
+        r.cSpread = strtod(cSpread.c_str(), NULL);
+        r.dSpread = strtod(dSpread.c_str(), NULL);
+        r.peakKiB = strtoul(peak.c_str(), NULL, 10);
+        r.ok = r.size != 0 && r.cSeconds > 0 && r.dSeconds > 0;
+        if (!r.ok)
+            return false;
+        results.push_back(r);
+    }
+    return !results.empty();
+}
+
+// Prints how the results compare to the baseline; returns the number
+// of regressions.
+int Compare(const vector<Result> & base, const vector<Result> & results,
+            double tolerance)
+{
+    printf("\n%-7s %-12s %9s %9s %7s %9s %9s %7s %9s %9s %7s\n",
+           "corpus", "options", "base bpc", "bpc", "change", "base c",
+           "c MB/s", "change", "base d", "d MB/s", "change");
+    int regressions = 0;
+    for (size_t i = 0; i != results.size(); ++i)
+    {
+        const Result & r = results[i];
+        const Result * b = NULL;
+        for (size_t j = 0; j != base.size() && b == NULL; ++j)
+        {
+            if (base[j].corpus == r.corpus && base[j].options == r.options)
+                b = &base[j];
+        }
+        if (b == NULL)
+        {
+            printf("%-7s %-12s not in the baseline\n",
+                   r.corpus.c_str(), r.options.c_str());
+            continue;
+        }
+
+        double bpcChange = Bpc(r) / Bpc(*b) - 1;
+        double cChange = CSpeed(r) / CSpeed(*b) - 1;
+        double dChange = DSpeed(r) / DSpeed(*b) - 1;
+        // a drop has to stand out from the noise of both runs
+        double cLimit = tolerance + 2 * max(r.cSpread, b->cSpread);
+        double dLimit = tolerance + 2 * max(r.dSpread, b->dSpread);
+
+        string why;
+        if (!r.ok)
+            why += " FAILED";
+        if (bpcChange > BPC_TOLERANCE)
+            why += " bpc";
+        if (-cChange > cLimit && b->cSeconds >= TIME_FLOOR)
+            why += " compression";
+        if (-dChange > dLimit && b->dSeconds >= TIME_FLOOR)
+            why += " decompression";
+
+        printf("%-7s %-12s %9.4f %9.4f %+6.2f%% %9.2f %9.2f %+6.1f%% "
+               "%9.2f %9.2f %+6.1f%%%s%s\n", r.corpus.c_str(),
+               r.options.c_str(), Bpc(*b), Bpc(r), 100 * bpcChange,
+               CSpeed(*b), CSpeed(r), 100 * cChange, DSpeed(*b), DSpeed(r),
+               100 * dChange, why.empty() ? "" : "  REGRESSION:", why.c_str());
+        regressions += !why.empty();
+    }
+    if (regressions != 0)
+        printf("\n%d regression%s against the baseline (speed tolerance "
+               "%.0f%% plus twice the spread, bpc tolerance %.1f%%)\n",
+               regressions, regressions != 1 ? "s" : "", 100 * tolerance,
+               100 * BPC_TOLERANCE);
+    else
+        printf("\nno regressions against the baseline\n");
+    return regressions;
+}
+
+int main(int argc, char ** argv)
+{
+    const char * savePath = NULL;
+    const char * comparePath = NULL;
+    int runs = 0;
+    double tolerance = 0.05;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:c:r:t:")) != -1)
+    {
+        if      (c == 's') savePath = optarg;
+        else if (c == 'c') comparePath = optarg;
+        else if (c == 'r') runs = atoi(optarg);
+        else if (c == 't') tolerance = atof(optarg) / 100;
+        else return 1;
+    }
+    if (runs <= 0)
+        runs = savePath != NULL || comparePath != NULL ? 3 : 1;
+
+    U32 size = (optind < argc ? atoi(argv[optind]) : 4) << 20;
+    if (size == 0 || access("./crook", X_OK) != 0)
+    {
+        fprintf(stderr, "usage: %s [-sSAVE.json] [-cBASE.json] [-rRUNS] "
+                "[-tPERCENT] [SIZE_MIB], with ./crook built\n", argv[0]);
+        return 1;
+    }
+
+    vector<Result> base;
+    if (comparePath != NULL)
+    {
+        if (!ReadBaseline(comparePath, base))
+        {
+            fprintf(stderr, "%s: cannot read the baseline '%s'\n",
+                    argv[0], comparePath);
+            return 1;
+        }
+        if (base[0].size != size)
+        {
+            fprintf(stderr, "%s: the baseline '%s' is of %u MiB corpora\n",
+                    argv[0], comparePath, base[0].size >> 20);
+            return 1;
+        }
+    }
+    mkdir("bench-data", 0777);
+
+    printf("%-7s %-12s %9s %9s %6s %8s %8s %7s %7s %8s\n",
+           "corpus", "options", "size", "code", "bpc", "c MB/s", "d MB/s",
+           "c s", "d s", "RSS MiB");
+
+    bool failed = false;
+    vector<Result> results;
+    for (size_t i = 0; i != sizeof corpora / sizeof corpora[0]; ++i)
+    {
+        char path[256];
+        snprintf(path, sizeof path, "bench-data/%s-%u-v%d",
+                 corpora[i].name, (U32)i + 1, corpora[i].version);
+        string text;
+        if (!ReadFile(path, text) || text.size() != size)
+        {
+            Random rng(i + 1);
+            text.clear();
+            corpora[i].generate(text, size, rng);
+            text.resize(size);
+            if (!WriteFile(path, text))
+            {
+                fprintf(stderr, "%s: cannot write '%s' (%s)\n",
+                        argv[0], path, strerror(errno));
+                return 1;
+            }
+        }
+
+        for (size_t j = 0; j != sizeof settings / sizeof settings[0]; ++j)
+        {
+            Result r = Measure(path, text, settings[j], runs);
+            r.corpus = corpora[i].name;
+            r.options = settings[j];
+            failed = failed || !r.ok;
+            results.push_back(r);
+
+            printf("%-7s %-12s %9u %9u %6.3f %8.2f %8.2f %7.2f %7.2f %8u%s\n",
+                   r.corpus.c_str(), r.options.c_str(), size, r.code, Bpc(r),
+                   CSpeed(r), DSpeed(r), r.cSeconds, r.dSeconds,
+                   r.peakKiB >> 10, r.ok ? "" : "  FAILED");
+            fflush(stdout);
+        }
+    }
+
+    if (savePath != NULL && !WriteBaseline(savePath, results))
+    {
+        fprintf(stderr, "%s: cannot write '%s' (%s)\n",
+                argv[0], savePath, strerror(errno));
+        return 1;
+    }
+    if (comparePath != NULL && Compare(base, results, tolerance) != 0)
+        failed = true;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,502 @@
+// BLOCKS
+//
+// A single lane is coded in blocks of BLOCK_SIZE bytes, each starting
+// with a byte giving its type:
+//
+// - BLOCK_CODED: the length of the code as a U32 and the code; the
+//   coder is flushed at the end of every block.
+//
+// - BLOCK_TRAINED: the bytes as they are, but the model has seen them.
+//   When the code of a block comes out longer than the block itself
+//   it's thrown away and the block is stored instead; the decompressor
+//   then trains its model on the block to stay in step.
+//
+// - BLOCK_SECOND: like BLOCK_CODED but coded by the second of two
+//   models, see Either below.
+//
+// - BLOCK_STORED: the bytes as they are.  Blocks whose order-0
+//   entropy is at least BLOCK_STORED_BPC bits per byte, typically
+//   data that has already been compressed, are stored without going
+//   through the model at all, so both directions run at the speed of
+//   the disk and the model doesn't fill up with noise.
+//
+// So no block costs more than five bytes over its length.  The model
+// can't learn a block it never sees though, so a second copy of the
+// same JPEG or .gz file, common in backups, costs as much as the first.
+// With -n the pre-scan is skipped and such blocks are coded, and
+// trained on if that doesn't pay, at the speed of the model.
+//
+// A block is read into memory, and its code collected there, before
+// anything of it is written.
+
+#ifndef BLOCKS_HPP
+#define BLOCKS_HPP
+
+#include "config.hpp"
+
+#include "byte_ppm.hpp"
+#include "costmap.hpp"
+#include "direct.hpp"
+#include "kernel.hpp"
+#include "model.hpp"
+#include "phases.hpp"
+#include "progress_bar.hpp"
+#include "timeline.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// Order-0 entropy in bits per byte.
+double Entropy(const U8 * text, U32 length)
+{
+    U32 counts[256] = { 0 };
+    for (U32 i = 0; i != length; ++i)
+        ++counts[text[i]];
+    double bits = 0;
+    for (int c = 0; c != 256; ++c)
+    {
+        if (counts[c] != 0)
+            bits -= counts[c] * log2((double)counts[c] / length);
+    }
+    return length != 0 ? bits / length : 0;
+}
+
+// Whether a block is stored without going through the model.
+bool IsNoise(const U8 * text, U32 length)
+{
+    return !learnNoise && Entropy(text, length) >= BLOCK_STORED_BPC;
+}
+
+template <class Coder, class Model>
+void EncodeText(const U8 * text, U32 length, Coder & rc, Model & model,
+                RelayoutSchedule & schedule, U32 processed,
+                U32 textLength, ProgressBar & bar)
+{
+    U32 i = 0;
+    for (; i != length && !model.IsFull(); ++i)
+    {
+        bar.Update(processed + i, textLength, model.GetUsedMemory());
+        schedule.Update(model, processed + i);
+        if (costMap != NULL)
+            costMap->Byte(processed + i, model.GetUsedMemory());
+        if (timeline != NULL)
+            timeline->Byte(processed + i, model);
+
+        if (costMap != NULL)
+            EncodeByteMapped(rc, model, text[i]);
+        else if (phases != NULL && phases->Sample())
+            EncodeByteTimed(rc, model, text[i]);
+        else
+            EncodeByte(rc, model, text[i]);
+    }
+    if (i != length && statistics != NULL)
+        statistics->Filled(processed + i);
+
+    Frozen<Model> frozen(model);
+    for (; i != length; ++i)
+    {
+        bar.Update(processed + i, textLength, model.GetUsedMemory());
+        schedule.Update(model, processed + i);
+        if (costMap != NULL)
+            costMap->Byte(processed + i, model.GetUsedMemory());
+        if (timeline != NULL)
+            timeline->Byte(processed + i, model);
+
+        if (costMap != NULL)
+            EncodeByteMapped(rc, frozen, text[i]);
+        else if (phases != NULL && phases->Sample())
+            EncodeByteTimed(rc, frozen, text[i]);
+        else
+            EncodeByte(rc, frozen, text[i]);
+    }
+    rc.FlushBuffer();
+}
+
+template <class Coder, class Model>
+void DecodeText(Coder & rc, U8 * text, U32 length, Model & model,
+                RelayoutSchedule & schedule, U32 processed,
+                U32 textLength, ProgressBar & bar)
+{
+    rc.FillBuffer();
+    U32 i = 0;
+    for (; i != length && !model.IsFull(); ++i)
+    {
+        bar.Update(processed + i, textLength, model.GetUsedMemory());
+        schedule.Update(model, processed + i);
+
+        if (phases != NULL && phases->Sample())
+            text[i] = DecodeByteTimed(rc, model);
+        else
+            text[i] = DecodeByte(rc, model);
+    }
+    if (i != length && statistics != NULL)
+        statistics->Filled(processed + i);
+
+    Frozen<Model> frozen(model);
+    for (; i != length; ++i)
+    {
+        bar.Update(processed + i, textLength, model.GetUsedMemory());
+        schedule.Update(model, processed + i);
+
+        if (phases != NULL && phases->Sample())
+            text[i] = DecodeByteTimed(rc, frozen);
+        else
+            text[i] = DecodeByte(rc, frozen);
+    }
+}
+
+// Updates the model as if the text had been coded, like
+// Dictionary::Train.
+template <class Model> void TrainText(const U8 * text, U32 length, Model & model)
+{
+    PhaseTimer timer(PHASE_MODEL);
+    for (U32 i = 0; i != length; ++i)
+    {
+        for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+        {
+            model.Predict();
+            if (text[i] & mask)
+                model.template Update<1>();
+            else
+                model.template Update<0>();
+        }
+    }
+}
+
+// TWO ENGINES
+//
+// With -b2 the tree and the bytewise model of "byte_ppm.hpp" both code
+// every block and the shorter code is kept, so each block is coded by
+// whichever engine suits it.  Both models are updated by every block
+// either way: the decompressor decodes a block with the model that
+// coded it and trains the other one on it.  That makes both directions
+// as slow as the two engines together; it's meant for comparing them
+// on real data rather than for everyday use.  Each model gets its own
+// -m of memory.
+
+template <class First, class Second> class Either
+{
+public:
+    First * first;
+    Second * second;
+
+    // Takes ownership of both models.
+    Either(First * first, Second * second) : first(first), second(second) {}
+
+    ~Either()
+    {
+        delete first;
+        delete second;
+    }
+
+    // The bit interface trains both models, as the dictionary does;
+    // the blocks never code through it.
+    U32 Predict()
+    {
+        second->Predict();
+        return first->Predict();
+    }
+
+    template <bool bit> void Update()
+    {
+        first->template Update<bit>();
+        second->template Update<bit>();
+    }
+
+    U32 GetUsedMemory()
+    {
+        return first->GetUsedMemory() + second->GetUsedMemory();
+    }
+
+    U64 GetUsedBytes()
+    {
+        return first->GetUsedBytes() + second->GetUsedBytes();
+    }
+
+    // each engine has its own -m
+    U32 GetMemoryLimit()
+    {
+        return first->GetMemoryLimit() + second->GetMemoryLimit();
+    }
+
+    int GetOrder()
+    {
+        return first->GetOrder();
+    }
+
+    bool IsFull()
+    {
+        return first->IsFull();
+    }
+
+    void Relayout()
+    {
+        first->Relayout();
+    }
+
+    void Save(Snapshot & snapshot)
+    {
+        first->Save(snapshot);
+        second->Save(snapshot);
+    }
+
+    bool Load(Snapshot & snapshot)
+    {
+        return first->Load(snapshot) && second->Load(snapshot);
+    }
+};
+
+// Codes a block into memory; code has to be freed.
+template <class Coder, class Model>
+void EncodeCode(const U8 * text, U32 length, Model & model,
+                RelayoutSchedule & schedule, U32 processed, U32 textLength,
+                ProgressBar & bar, char * & code, size_t & codeLength)
+{
+    FILE * stream = open_memstream(&code, &codeLength);
+    if (stream == NULL)
+    {
+        fprintf(stderr, "crook: out of memory\n");
+        exit(1);
+    }
+    if (timeline != NULL)
+        timeline->Code(stream);
+    BitCounter<Coder, Model> * counter = NULL;
+    if (statistics != NULL)
+        counter = new BitCounter<Coder, Model>(model);
+    {
+        Coder rc(stream);
+        EncodeText(text, length, rc, model, schedule, processed,
+                   textLength, bar);
+    }
+    if (counter != NULL)
+    {
+        counter->Count(text, length);
+        delete counter;
+    }
+    if (timeline != NULL)
+        timeline->Code(NULL);
+    fclose(stream);
+}
+
+// Codes a block into memory and returns its type, BLOCK_CODED or
+// BLOCK_SECOND.
+template <class Coder, class Model>
+int EncodeBlock(const U8 * text, U32 length, Model & model,
+                RelayoutSchedule & schedule, U32 processed, U32 textLength,
+                ProgressBar & bar, char * & code, size_t & codeLength)
+{
+    EncodeCode<Coder>(text, length, model, schedule, processed, textLength,
+                      bar, code, codeLength);
+    return BLOCK_CODED;
+}
+
+template <class Coder, class First, class Second>
+int EncodeBlock(const U8 * text, U32 length, Either<First, Second> & model,
+                RelayoutSchedule & schedule, U32 processed, U32 textLength,
+                ProgressBar & bar, char * & code, size_t & codeLength)
+{
+    char * other;
+    size_t otherLength;
+    RelayoutSchedule never(-1);
+    CostMap::State before, first;
+    if (costMap != NULL)
+        before = costMap->Save();
+    EncodeCode<Coder>(text, length, *model.first, schedule, processed,
+                      textLength, bar, code, codeLength);
+    if (costMap != NULL)
+    {
+        first = costMap->Save();
+        costMap->Restore(before);
+    }
+    EncodeCode<Coder>(text, length, *model.second, never, processed,
+                      textLength, bar, other, otherLength);
+    int type = BLOCK_CODED;
+    if (otherLength < codeLength)
+    {
+        swap(code, other);
+        swap(codeLength, otherLength);
+        type = BLOCK_SECOND;
+    }
+    else if (costMap != NULL)
+        costMap->Restore(first);
+    free(other);
+    return type;
+}
+
+template <class Coder, class Model>
+void DecodeBlock(int, Coder & rc, U8 * text, U32 length, Model & model,
+                 RelayoutSchedule & schedule, U32 processed,
+                 U32 textLength, ProgressBar & bar)
+{
+    DecodeText(rc, text, length, model, schedule, processed, textLength, bar);
+}
+
+template <class Coder, class First, class Second>
+void DecodeBlock(int type, Coder & rc, U8 * text, U32 length,
+                 Either<First, Second> & model, RelayoutSchedule & schedule,
+                 U32 processed, U32 textLength, ProgressBar & bar)
+{
+    if (type == BLOCK_SECOND)
+    {
+        RelayoutSchedule never(-1);
+        DecodeText(rc, text, length, *model.second, never, processed,
+                   textLength, bar);
+        TrainText(text, length, *model.first);
+    }
+    else
+    {
+        DecodeText(rc, text, length, *model.first, schedule, processed,
+                   textLength, bar);
+        TrainText(text, length, *model.second);
+    }
+}
+
+template <class Coder, class Model>
+void EncodeBlocks(FILE * textFile, FILE * codeFile, Model & model,
+                  U32 textLength, ProgressBar & bar)
+{
+    U8 * text = new U8[BLOCK_SIZE];
+    RelayoutSchedule schedule;
+    for (U32 processed = 0; processed != textLength; )
+    {
+        U32 length = min(textLength - processed, BLOCK_SIZE);
+        {
+            PhaseTimer timer(PHASE_INPUT);
+            if (fread(text, 1, length, textFile) != length)
+                memset(text, 0, length); // the caller checks ferror
+        }
+
+        if (timeline != NULL)
+            timeline->Block(ftell(codeFile));
+
+        if (IsNoise(text, length))
+        {
+            if (timeline != NULL)
+                timeline->Raw(processed, length, model);
+            if (costMap != NULL)
+            {
+                costMap->Raw(processed, length, model.GetUsedMemory());
+                costMap->Flush();
+            }
+            PhaseTimer timer(PHASE_OUTPUT);
+            putc(BLOCK_STORED, codeFile);
+            fwrite(text, 1, length, codeFile);
+            processed += length;
+            continue;
+        }
+
+        char * code;
+        size_t codeLength;
+        int type;
+        CostMap::State before;
+        if (costMap != NULL)
+            before = costMap->Save();
+        {
+            PhaseTimer timer(PHASE_CODING);
+            type = EncodeBlock<Coder>(text, length, model, schedule,
+                                      processed, textLength, bar,
+                                      code, codeLength);
+        }
+
+        if (costMap != NULL)
+        {
+            if (codeLength >= length)
+            {
+                costMap->Restore(before);
+                costMap->Raw(processed, length, model.GetUsedMemory());
+            }
+            costMap->Flush();
+        }
+
+        PhaseTimer timer(PHASE_OUTPUT);
+        if (codeLength < length)
+        {
+            putc(type, codeFile);
+            PutU32(codeLength, codeFile);
+            fwrite(code, 1, codeLength, codeFile);
+        }
+        else
+        {
+            putc(BLOCK_TRAINED, codeFile);
+            fwrite(text, 1, length, codeFile);
+        }
+        free(code);
+        processed += length;
+    }
+    delete[] text;
+}
+
+template <class Coder, class Model>
+void DecodeBlocks(FILE * codeFile, FILE * textFile, Model & model,
+                  U32 textLength, ProgressBar & bar)
+{
+    U8 * text = new U8[BLOCK_SIZE];
+    RelayoutSchedule schedule;
+    for (U32 processed = 0; processed != textLength; )
+    {
+        U32 length = min(textLength - processed, BLOCK_SIZE);
+        int type;
+        {
+            PhaseTimer timer(PHASE_INPUT);
+            type = getc(codeFile);
+        }
+
+        if (type == BLOCK_CODED || type == BLOCK_SECOND)
+        {
+            // a truncated block decodes as garbage, the caller checks ferror
+            U32 codeLength;
+            char * code;
+            {
+                PhaseTimer timer(PHASE_INPUT);
+                codeLength = GetU32(codeFile);
+                code = (char *) calloc(max(codeLength, 1u), 1);
+                if (code == NULL ||
+                    fread(code, 1, codeLength, codeFile) != codeLength)
+                    codeLength = 0;
+            }
+            PhaseTimer timer(PHASE_CODING);
+            FILE * stream = fmemopen(code, max(codeLength, 1u), "rb");
+            if (stream == NULL)
+            {
+                fprintf(stderr, "crook: out of memory\n");
+                exit(1);
+            }
+            BitCounter<Coder, Model> * counter = NULL;
+            if (statistics != NULL)
+                counter = new BitCounter<Coder, Model>(model);
+            {
+                Coder rc(stream);
+                DecodeBlock(type, rc, text, length, model, schedule,
+                            processed, textLength, bar);
+            }
+            if (counter != NULL)
+            {
+                counter->Count(text, length);
+                delete counter;
+            }
+            fclose(stream);
+            free(code);
+        }
+        else
+        {
+            {
+                PhaseTimer timer(PHASE_INPUT);
+                if (fread(text, 1, length, codeFile) != length)
+                    memset(text, 0, length);
+            }
+            if (type == BLOCK_TRAINED)
+                TrainText(text, length, model);
+        }
+
+        {
+            PhaseTimer timer(PHASE_OUTPUT);
+            fwrite(text, 1, length, textFile);
+        }
+        processed += length;
+    }
+    delete[] text;
+}
+
+#endif
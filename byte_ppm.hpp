@@ -0,0 +1,493 @@
+// THE BYTEWISE MODEL
+//
+// For comparison with the tree, -b1 codes whole bytes with escapes as
+// in classic PPM (and Shkarin's PPMd, minus the SEE and the tricks):
+// every context keeps a list of the bytes that have followed it with
+// their frequencies.  A byte is coded in the longest context first; if
+// it isn't in the list an escape is coded and the next shorter context
+// is tried, without the bytes that have already been ruled out
+// (exclusion).  Below order 0 every byte that's left is equally likely.
+// The escape frequency of a context is the number of bytes left in
+// its list, as in PPMC.
+//
+// The coders only code bits, so a context's list is coded as a series
+// of yes/no decisions: is it the first byte of the list, if not is it
+// the second and so on, the probability of each being its frequency
+// over the total of the bytes that haven't been ruled out plus the
+// escape.  This is the same distribution as coding the list at once.
+// The lists are kept roughly sorted by frequency so that common bytes
+// take few decisions.
+//
+// Contexts are linked like the nodes of the tree: a context has a
+// suffix pointer to the one a byte shorter, and each byte in its list
+// points to the context extended by that byte on the right, if there
+// is one yet.  A byte added to a context is also added to every
+// shorter one it escaped from, so the next context can always be found
+// by following the suffix pointers.
+//
+// Contexts and lists share a pool of -m bytes addressed by 32-bit
+// offsets.  Lists grow by doubling and the old ones are reused through
+// free lists by size.  Once the pool is full no new contexts or list
+// entries are made but the frequencies are still updated.
+//
+// The bit interface (Predict and Update<bit>) only collects the bits
+// of a byte and updates the model with it, which is all the dictionary
+// and the stored blocks need.
+//
+// See also: the kernels at the end of this file.
+
+#ifndef BYTE_PPM_HPP
+#define BYTE_PPM_HPP
+
+#include "config.hpp"
+
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+struct ByteSymbol
+{
+    U8  c;
+    U8  unused;
+    U16 freq;
+    U32 next; // the context extended by c, or 0
+};
+
+struct ByteContext
+{
+    U32 sfx;     // 0 for order 0
+    U32 symbols;
+    U16 count;
+    U8  log2Capacity;
+    U8  order;
+};
+
+class BytePPM
+{
+    static const int CLASSES = 9; // lists of 1 .. 256 symbols
+
+    U8 * pool;
+    U32 top;
+    U32 end;
+    U32 freeLists[CLASSES];
+
+    const int orderLimit;
+    U32 root;
+    U32 act;
+    U32 partial; // 1 followed by the bits collected by Update<bit>
+
+    // the walk of the kernels
+    U32 masked[256]; // byte c is ruled out if masked[c] == stamp
+    U32 stamp;
+    U32 cur;         // the context being coded, 0 below order 0
+    U32 pos;         // the next symbol of its list
+    U32 remaining;   // total of the candidates left, with the escape
+
+    template <class T> T * At(U32 offset)
+    {
+        return (T *)(pool + offset);
+    }
+
+    U32 Allocate(U32 size)
+    {
+        if (end - top < size)
+            return 0;
+        top += size;
+        return top - size;
+    }
+
+    U32 AllocateList(int k)
+    {
+        U32 list = freeLists[k];
+        if (list != 0)
+        {
+            freeLists[k] = *At<U32>(list);
+            return list;
+        }
+        return Allocate(sizeof(ByteSymbol) << k);
+    }
+
+    U32 NewContext(U32 sfx, int order)
+    {
+        U32 offset = Allocate(sizeof(ByteContext));
+        if (offset != 0)
+        {
+            ByteContext * ctx = At<ByteContext>(offset);
+            ctx->sfx = sfx;
+            ctx->symbols = 0;
+            ctx->count = 0;
+            ctx->log2Capacity = 0;
+            ctx->order = order;
+            if (statistics != NULL)
+                statistics->ContextCreated();
+        }
+        return offset;
+    }
+
+    ByteSymbol * Find(ByteContext * ctx, U32 c)
+    {
+        ByteSymbol * s = At<ByteSymbol>(ctx->symbols);
+        for (ByteSymbol * e = s + ctx->count; s != e; ++s)
+        {
+            if (s->c == c)
+                return s;
+        }
+        return NULL;
+    }
+
+    // Returns NULL if the pool is full.
+    ByteSymbol * Add(ByteContext * ctx, U32 c)
+    {
+        if (ctx->symbols == 0 || ctx->count == 1u << ctx->log2Capacity)
+        {
+            int k = ctx->symbols == 0 ? 0 : ctx->log2Capacity + 1;
+            U32 list = AllocateList(k);
+            if (list == 0)
+                return NULL;
+            if (ctx->symbols != 0)
+            {
+                memcpy(At<ByteSymbol>(list), At<ByteSymbol>(ctx->symbols),
+                       ctx->count * sizeof(ByteSymbol));
+                *At<U32>(ctx->symbols) = freeLists[ctx->log2Capacity];
+                freeLists[ctx->log2Capacity] = ctx->symbols;
+            }
+            ctx->symbols = list;
+            ctx->log2Capacity = k;
+        }
+        ByteSymbol * s = At<ByteSymbol>(ctx->symbols) + ctx->count++;
+        s->c = c;
+        s->unused = 0;
+        s->freq = BYTES_F_INIT;
+        s->next = 0;
+        return s;
+    }
+
+    // Bumps the frequency of s and moves it ahead of its predecessor
+    // if it has overtaken it.  Returns where s ended up.
+    ByteSymbol * Bump(ByteContext * ctx, ByteSymbol * s)
+    {
+        s->freq += BYTES_F_INC;
+        if (s->freq >= BYTES_F_LIMIT)
+        {
+            ByteSymbol * t = At<ByteSymbol>(ctx->symbols);
+            for (ByteSymbol * e = t + ctx->count; t != e; ++t)
+                t->freq = (t->freq + 1) / 2;
+        }
+        if (s != At<ByteSymbol>(ctx->symbols) && s[-1].freq < s->freq)
+        {
+            swap(s[-1], s[0]);
+            --s;
+        }
+        return s;
+    }
+
+    // Starts coding in ctx: sums up the candidates left in it.  Returns
+    // false if there are none, then there's nothing to code.
+    bool Enter(U32 ctx)
+    {
+        cur = ctx;
+        pos = 0;
+        remaining = 0;
+        if (ctx == 0)
+        {
+            for (U32 c = 0; c != 256; ++c)
+                remaining += masked[c] != stamp;
+            return true;
+        }
+        ByteContext * context = At<ByteContext>(ctx);
+        ByteSymbol * s = At<ByteSymbol>(context->symbols);
+        U32 left = 0;
+        for (ByteSymbol * e = s + context->count; s != e; ++s)
+        {
+            if (masked[s->c] != stamp)
+                remaining += s->freq, ++left;
+        }
+        remaining += left * BYTES_ESCAPE;
+        return left != 0;
+    }
+
+public:
+    BytePPM(int memoryLimit, int orderLimit)
+        : orderLimit(min(orderLimit, 255)),
+          partial(1),
+          stamp(0)
+    {
+        end = (U32) min((U64)memoryLimit << 20, (U64)0xFFFFF000);
+        end = max(end, (U32)(1 << 16));
+        pool = (U8 *) AllocatePages(end);
+        top = sizeof(U64); // offset 0 is the null pointer
+        memset(freeLists, 0, sizeof freeLists);
+        memset(masked, 0xFF, sizeof masked);
+
+        root = act = NewContext(0, 0);
+    }
+
+    ~BytePPM()
+    {
+        FreePages(pool, end);
+    }
+
+    // THE WALK OF THE KERNELS
+    //
+    // Start begins a byte, then Next returns the candidates one by one
+    // along with the probability, with PPM_P_BITS of precision, that
+    // the byte is that candidate.  A probability of PPM_P_SCALE means
+    // it's the only one left.  The caller stops at the right one and
+    // passes it to Update.
+
+    void Start()
+    {
+        if (++stamp == 0)
+        {
+            memset(masked, 0xFF, sizeof masked);
+            stamp = 1;
+        }
+        U32 ctx = act;
+        while (ctx != 0 && !Enter(ctx))
+            ctx = At<ByteContext>(ctx)->sfx;
+        if (ctx == 0)
+            Enter(0);
+    }
+
+    U32 Next(U32 & p)
+    {
+        for (;;)
+        {
+            if (cur == 0)
+            {
+                // every byte ruled out only happens when decoding a
+                // corrupted file; any byte will do, as long as the
+                // decoder doesn't crash
+                if (remaining == 0)
+                {
+                    p = PPM_P_SCALE;
+                    return 0;
+                }
+                while (pos < 256 && masked[pos] == stamp)
+                    ++pos;
+                masked[pos] = stamp;
+                p = remaining == 1 ? PPM_P_SCALE : PPM_P_SCALE / remaining;
+                --remaining;
+                return pos++;
+            }
+
+            ByteContext * ctx = At<ByteContext>(cur);
+            ByteSymbol * s = At<ByteSymbol>(ctx->symbols);
+            for (; pos != ctx->count; ++pos)
+            {
+                if (masked[s[pos].c] == stamp)
+                    continue;
+                U32 c = s[pos++].c;
+                U32 freq = s[pos - 1].freq;
+                masked[c] = stamp;
+                p = ((U64)freq << PPM_P_BITS) / remaining;
+                p = max(p, 1u);
+                remaining -= freq;
+                return c;
+            }
+
+            // an escape: on to the next context with candidates left
+            U32 sfx = ctx->sfx;
+            while (sfx != 0 && !Enter(sfx))
+                sfx = At<ByteContext>(sfx)->sfx;
+            if (sfx == 0)
+                Enter(0);
+        }
+    }
+
+    // Updates the frequencies of the contexts from the longest one down
+    // to the first that knew c and moves on to the next context.
+    void Update(U32 c)
+    {
+        ByteSymbol * found = NULL;
+        for (U32 ctx = act; ctx != 0 && found == NULL; )
+        {
+            ByteContext * context = At<ByteContext>(ctx);
+            found = Find(context, c);
+            if (found != NULL)
+                Bump(context, found);
+            else
+                Add(context, c);
+            ctx = context->sfx;
+        }
+
+        // The next context is the one of act extended by c, shortened
+        // to the order limit.  The contexts extended by c on the way
+        // down that don't exist yet are made, shortest first, so each
+        // gets its suffix.
+        U32 chain[256];
+        int n = 0;
+        U32 next = root;
+        U32 ctx = act;
+        if (At<ByteContext>(ctx)->order == orderLimit)
+            ctx = At<ByteContext>(ctx)->sfx;
+        for (; ctx != 0; ctx = At<ByteContext>(ctx)->sfx)
+        {
+            ByteSymbol * s = Find(At<ByteContext>(ctx), c);
+            if (s != NULL && s->next != 0)
+            {
+                next = s->next;
+                break;
+            }
+            chain[n++] = ctx;
+        }
+        while (n != 0)
+        {
+            ByteContext * context = At<ByteContext>(chain[--n]);
+            ByteSymbol * s = Find(context, c);
+            U32 extended;
+            if (s == NULL ||
+                (extended = NewContext(next, context->order + 1)) == 0)
+                break;
+            s->next = extended;
+            next = extended;
+        }
+        act = next;
+    }
+
+    // THE BIT INTERFACE
+
+    U32 Predict()
+    {
+        return PPM_P_START;
+    }
+
+    template <bool bit> void Update()
+    {
+        partial = (partial << 1) + bit;
+        if (partial >= 256)
+        {
+            Update(partial - 256);
+            partial = 1;
+        }
+    }
+
+    template <bool bit> void UpdateFrozen()
+    {
+        Update<bit>();
+    }
+
+    int GetOrder()
+    {
+        return 8 * At<ByteContext>(act)->order;
+    }
+
+    // The order of the context Next returned the last candidate from,
+    // or -1 below order 0.
+    int GetCodedOrder()
+    {
+        return cur == 0 ? -1 : At<ByteContext>(cur)->order;
+    }
+
+    // A full pool only stops growth, the drivers needn't switch to
+    // Frozen.
+    bool IsFull()
+    {
+        return false;
+    }
+
+    void Relayout() {}
+
+    U32 GetUsedMemory()
+    {
+        return top >> 20;
+    }
+
+    U64 GetUsedBytes()
+    {
+        return top;
+    }
+
+    U32 GetMemoryLimit()
+    {
+        return ((U64)end + (1 << 20) - 1) >> 20;
+    }
+
+    void Save(Snapshot & snapshot)
+    {
+        snapshot.PutU32(end);
+        snapshot.PutU32(orderLimit);
+        snapshot.PutU32(act);
+        snapshot.PutU32(partial);
+        for (int k = 0; k != CLASSES; ++k)
+            snapshot.PutU32(freeLists[k]);
+        snapshot.PutPool(pool, top);
+    }
+
+    // Returns false if the snapshot was made with other limits.
+    bool Load(Snapshot & snapshot)
+    {
+        U32 savedEnd = snapshot.GetU32();
+        int savedOrderLimit = snapshot.GetU32();
+        if (savedEnd != end || savedOrderLimit != orderLimit)
+            return false;
+        act = snapshot.GetU32();
+        partial = snapshot.GetU32();
+        for (int k = 0; k != CLASSES; ++k)
+            freeLists[k] = snapshot.GetU32();
+        U64 size;
+        if (!snapshot.MapPool(pool, end, size))
+            return false;
+        top = size;
+        return true;
+    }
+};
+
+// Byte kernels for the bytewise model, preferred over the ones in
+// "kernel.hpp".  A decision whose answer is certain isn't coded.
+
+template <class Coder>
+inline void EncodeByte(Coder & rc, BytePPM & model, U32 c)
+{
+    model.Start();
+    for (;;)
+    {
+        U32 p;
+        U32 candidate = model.Next(p);
+        if (p == PPM_P_SCALE)
+            break;
+        U32 p1 = Fit0(p, PPM_P_BITS, Coder::P_BITS);
+        if (statistics != NULL)
+            statistics->Decision(model.GetCodedOrder(), p1, Coder::P_BITS,
+                                 candidate == c);
+        if (candidate == c)
+        {
+            rc.template Encode<1>(p1);
+            rc.Normalize();
+            break;
+        }
+        rc.template Encode<0>(p1);
+        rc.Normalize();
+    }
+    model.Update(c);
+}
+
+template <class Coder>
+inline U32 DecodeByte(Coder & rc, BytePPM & model)
+{
+    model.Start();
+    U32 c;
+    for (;;)
+    {
+        U32 p;
+        c = model.Next(p);
+        if (p == PPM_P_SCALE)
+            break;
+        U32 p1 = Fit0(p, PPM_P_BITS, Coder::P_BITS);
+        U32 bit = rc.Decode(p1);
+        if (statistics != NULL)
+            statistics->Decision(model.GetCodedOrder(), p1, Coder::P_BITS,
+                                 bit);
+        rc.Normalize();
+        if (bit)
+            break;
+    }
+    model.Update(c);
+    return c;
+}
+
+#endif
@@ -4,12 +4,16 @@
 // disable asserts for a moderate speed-up:
 #define NDEBUG
 
+// count how the model's steps hit the cache, see "model.hpp":
+// #define LOCALITY_STATS
+
 #include <cassert>
 #include <cstdio>
 #include <stdint.h>
 
-// since crook is single-threaded it won't need thread-safe I/O; with
-// GNU libc (and others?) the _unlocked variants are much faster.
+// since every file is only ever used by a single thread crook won't
+// need thread-safe I/O; with GNU libc (and others?) the _unlocked
+// variants are much faster.
 #ifdef __GLIBC__
 #define putc putc_unlocked
 #define getc getc_unlocked
@@ -36,10 +40,34 @@ typedef uint64_t U64;
 //   _LIMIT - one larger than the largest number that can be represented
 //            if omitted then equal to _SCALE (i.e. there's no whole part)
 
-// probabilities in the range coder, see "rc.hpp".
+// probabilities in the range coder, see "rc_encoder.hpp".
 const U32 ARI_P_BITS  = 12;
 const U32 ARI_P_SCALE = 1 << ARI_P_BITS;
 
+// probabilities in the 64-bit range coder, see "rc64_encoder.hpp".
+const U32 ARI64_P_BITS  = 16;
+const U32 ARI64_P_SCALE = 1 << ARI64_P_BITS;
+
+// the rANS coder, see "rans_encoder.hpp".  A block's code takes at
+// most two bytes per bit plus the final states.
+const U32 RANS_L          = 1 << 23;
+const U32 RANS_STREAMS    = 4;
+const U32 RANS_BLOCK_SIZE = 1 << 20;
+const U32 RANS_CODE_LIMIT = 2 * RANS_BLOCK_SIZE + 4 * RANS_STREAMS;
+
+// blocks of a single lane, see "blocks.hpp".  Blocks with at least
+// BLOCK_STORED_BPC bits per byte of order-0 entropy are stored.
+const U32 BLOCK_SIZE = 1 << 20;
+const double BLOCK_STORED_BPC = 7.95;
+const int BLOCK_CODED   = 0;
+const int BLOCK_TRAINED = 1;
+const int BLOCK_SECOND  = 2;
+const int BLOCK_STORED  = 3;
+
+// interleaved blocks, see "lanes.hpp".
+const int LANES_LIMIT      = 4;
+const U32 LANE_BUFFER_SIZE = 1 << 16;
+
 // used for the reciprocal table, see "divide.hpp".
 const U32 DIVISOR_BITS     = 10;
 const U32 DIVISOR_LIMIT    = 1 << DIVISOR_BITS;
@@ -58,10 +86,96 @@ const U32 PPM_P_START = PPM_P_SCALE / 2;
 const U32 PPM_C_START = PPM_C_SCALE * 12;     // these were hand-tuned
 const U32 PPM_C_INH   = PPM_C_SCALE * 3 / 2;  // on enwik7
 const U32 PPM_C_INC   = PPM_C_SCALE;
+// the most updates -k can ask for before the count saturates
+const int PPM_VISITS_LIMIT = (PPM_C_LIMIT - 1 - PPM_C_INH) / PPM_C_INC;
+const U32 PPM_REGION_NODES = 256; // a 4 KiB page of 16-byte nodes
+
+// probabilities in the direct table model, see "direct.hpp".
+const U32 DIRECT_P_BITS  = 16;
+const U32 DIRECT_P_SCALE = 1 << DIRECT_P_BITS;
+const U32 DIRECT_RATE    = 4;  // adaptation rate as a right shift
+
+// frequencies in the bytewise model, see "byte_ppm.hpp".  The
+// frequencies of a context are halved once one reaches BYTES_F_LIMIT.
+const U32 BYTES_F_INIT  = 1;
+const U32 BYTES_F_INC   = 2;
+const U32 BYTES_F_LIMIT = 1 << 12;
+const U32 BYTES_ESCAPE  = 1;  // escape frequency per symbol left
+
+// the progress bar, see "progress_bar.hpp": the clock is read every
+// PROGRESS_CHECK bytes and the bar redrawn every PROGRESS_INTERVAL s.
+const U32 PROGRESS_CHECK = 1 << 16;
+const double PROGRESS_INTERVAL = 0.1;
+
+// suffix walks of up to STATS_WALK_LIMIT-1 steps are told apart by -v,
+// see "stats.hpp".
+const U32 STATS_WALK_LIMIT = 16;
+
+// one byte in PHASES_SAMPLE is timed in detail by --phases, see
+// "phases.hpp".
+const U32 PHASES_SAMPLE = 64;
+
+// crook e -sN models N samples of ESTIMATE_SAMPLE bytes, see
+// "estimate.hpp".
+const U32 ESTIMATE_SAMPLE = 1 << 22;
+
+// how often the model is checked for a relayout, see "model.hpp".
+const U32 RELAYOUT_CHECK = 1 << 16;
+
+// engine ids stored in the compressed file, chosen with the levels
+// and -b.
+const int ENGINE_PPM    = 0; // the tree, see "model.hpp" and "mixer.hpp"
+const int ENGINE_ORDER1 = 1; // order-1 table, see "direct.hpp"
+const int ENGINE_ORDER2 = 2; // order-2 table, see "direct.hpp"
+const int ENGINE_BYTES  = 3; // bytewise PPM, see "byte_ppm.hpp"
+const int ENGINE_EITHER = 4; // the tree or bytewise PPM, see "blocks.hpp"
+const int NUM_ENGINES   = 5;
+
+// node allocators, see "model.hpp".
+const int ALLOC_BUMP     = 0; // new nodes at the top of the pool
+const int ALLOC_REGIONS  = 1; // new nodes near their parents
+const int NUM_ALLOCATORS = 2;
+
+// stretched probabilities and weights in the mixer, see "mixer.hpp".
+const int MIX_S_SCALE = 1 << 8;
+const int MIX_S_LIMIT = 2047;
+const int MIX_W_BITS  = 16;
+const int MIX_W_SCALE = 1 << MIX_W_BITS;
+const int MIX_W_LIMIT = MIX_W_SCALE * 8;
+const int MIX_W_SETS  = 16;
+const int MIX_W_RATE  = 11;  // learning rate as a right shift
+
+// size of the snapshot header and alignment of the pools in it, see
+// "snapshot.hpp".
+const U32 SNAPSHOT_ALIGN = 1 << 16;
+
+// coder ids stored in the compressed file.
+const int CODER_RC   = 0; // arithmetic coder, see "rc_encoder.hpp"
+const int CODER_RANS = 1; // rANS coder, see "rans_encoder.hpp"
+const int CODER_RC64 = 2; // 64-bit arithmetic coder, see "rc64_encoder.hpp"
+const int NUM_CODERS = 3;
 
 // global command line options, defined in "crook.cpp".
-extern int command;     // 'c' or 'd'
+extern int command;     // 'c', 'd', 'e' or 'p'
 extern int memoryLimit; // memory limit in MiB
 extern int orderLimit;  //  order limit in bytes
+extern int mixOrderLimit; // order limit of the second model or -1
+extern const char * dictionaryPath; // preset dictionary file or NULL
+extern int jobs;        // number of worker threads
+extern int coder;       // coder for compression, see CODER_*
+extern int lanes;       // number of blocks interleaved in one thread
+extern int nodeAllocator; // node allocator, see ALLOC_*
+extern int relayoutPeriod; // relayout period in MiB, 0 when full, -1 never
+extern int minVisits;   // updates a node needs before it's extended
+extern bool learnNoise; // send incompressible blocks through the model
+extern int engine;      // engine for compression, see ENGINE_*
+extern bool verbose;    // print coding statistics
+extern bool quiet;      // print nothing but errors
+extern int progressFd;  // file descriptor for JSON progress or -1
+extern bool perfCounters; // count with the hardware counters
+extern bool timePhases; // time input, model, coder and output
+extern int costMapWindow; // cost map window in KiB, 0 for no map
+extern int timelineInterval; // timeline interval in KiB, 0 for none
+extern int estimateSamples; // samples estimated by crook e, 0 for all
 
 #endif
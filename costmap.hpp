@@ -0,0 +1,164 @@
+// THE COST MAP
+//
+// With -wN compressing a file also writes OUTPUT.map, a CSV file with a
+// line for every window of N KiB of the input:
+//
+// > offset,bytes,code_bits,bpc,raw_bytes,memory_mib
+// > 0,65536,93017,11.355,0,2
+// > 65536,65536,71893,8.776,0,3
+//
+// code_bits is what the window cost: -log2 of the probability of every
+// decision coded in it, at the precision the coder codes with (see
+// Cost in "stats.hpp"), plus 8 bits for each of the raw_bytes that were
+// stored as they are (see "blocks.hpp").  Block headers and the coder's
+// flushes aren't counted, so the map adds up to a little less than the
+// file.  memory_mib is the memory the model used
+// at the end of the window.  A window that costs far more than its
+// neighbours, say an embedded binary in a log, is one to look at.
+//
+// With -b2 a block is coded by both engines and only the costs of the
+// one that's kept are mapped.  The map needs a single lane, so -w
+// can't be used with -i.
+//
+// Like the statistics it's reached through a thread-local pointer, NULL
+// unless a map is being written.  The kernels don't look at it: the
+// bytes of a mapped file are coded through a coder that adds up their
+// costs on the way, so the other files pay only for a test per byte.
+// Those bytes aren't sampled by --phases.
+
+#ifndef COSTMAP_HPP
+#define COSTMAP_HPP
+
+#include "config.hpp"
+
+#include "kernel.hpp"
+#include "stats.hpp"
+
+#include <string>
+
+class CostMap
+{
+public:
+    struct State
+    {
+        U64 index;   // of the window being filled
+        U32 bytes;   // in it so far
+        U32 raw;
+        U32 memory;
+        double bits;
+        string lines; // finished windows not written yet
+    };
+
+private:
+    FILE * file;
+    U32 size;    // of a window in bytes
+    State state;
+
+    void Next(U64 index)
+    {
+        if (state.bytes != 0)
+        {
+            char line[128];
+            snprintf(line, sizeof line, "%llu,%u,%.0f,%.3f,%u,%u\n",
+                     (unsigned long long)state.index * size, state.bytes,
+                     state.bits, state.bits / state.bytes, state.raw,
+                     state.memory);
+            state.lines += line;
+        }
+        state.index = index;
+        state.bytes = state.raw = 0;
+        state.bits = 0;
+    }
+public:
+    CostMap(FILE * file, U32 size) : file(file), size(size)
+    {
+        state.index = 0;
+        state.bytes = state.raw = state.memory = 0;
+        state.bits = 0;
+        fprintf(file, "offset,bytes,code_bits,bpc,raw_bytes,memory_mib\n");
+    }
+
+    // Called before every byte that's coded.
+    void Byte(U64 position, U32 memory)
+    {
+        if (position / size != state.index)
+            Next(position / size);
+        ++state.bytes;
+        state.memory = memory;
+    }
+
+    void Bit(U32 p1, U32 pBits, U32 bit)
+    {
+        state.bits += Cost(p1, pBits, bit);
+    }
+
+    // Bytes stored as they are.
+    void Raw(U64 position, U32 length, U32 memory)
+    {
+        for (U64 i = position; i != position + length; ++i)
+        {
+            Byte(i, memory);
+            ++state.raw;
+            state.bits += 8;
+        }
+    }
+
+    // To try coding a block in different ways and keep one.
+    State Save()
+    {
+        return state;
+    }
+
+    void Restore(const State & saved)
+    {
+        state = saved;
+    }
+
+    // Writes out the finished windows, at the end of every block.
+    void Flush()
+    {
+        fwrite(state.lines.data(), 1, state.lines.size(), file);
+        state.lines.clear();
+    }
+
+    // Ends the last window.
+    void Finish()
+    {
+        Next(state.index + 1);
+        Flush();
+    }
+};
+
+__thread CostMap * costMap = NULL; // this thread's, or NULL
+
+// A coder that adds the cost of every bit to the map before passing it
+// on to another one.
+template <class Coder> class MappedCoder
+{
+    Coder & rc;
+public:
+    static const U32 P_BITS = Coder::P_BITS;
+
+    MappedCoder(Coder & rc) : rc(rc) {}
+
+    template <bool bit> void Encode(U32 p1)
+    {
+        costMap->Bit(p1, P_BITS, bit);
+        rc.template Encode<bit>(p1);
+    }
+
+    void Normalize()
+    {
+        rc.Normalize();
+    }
+};
+
+// Codes a byte with the usual kernels, see "kernel.hpp", mapping it.
+template <class Coder, class Model>
+void EncodeByteMapped(Coder & rc, Model & model, U32 c)
+{
+    MappedCoder<Coder> mapped(rc);
+    EncodeByte(mapped, model, c);
+}
+
+#endif
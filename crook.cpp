@@ -1,132 +1,735 @@
 #include "config.hpp"
 
+#include "blocks.hpp"
+#include "byte_ppm.hpp"
+#include "costmap.hpp"
+#include "dictionary.hpp"
+#include "direct.hpp"
 #include "divide.hpp"
+#include "estimate.hpp"
 #include "getopt.hpp"
+#include "kernel.hpp"
+#include "lanes.hpp"
+#include "mixer.hpp"
 #include "model.hpp"
+#include "perf.hpp"
+#include "phases.hpp"
 #include "progress_bar.hpp"
+#include "rans_decoder.hpp"
+#include "rans_encoder.hpp"
+#include "rc64_decoder.hpp"
+#include "rc64_encoder.hpp"
 #include "rc_decoder.hpp"
 #include "rc_encoder.hpp"
+#include "stats.hpp"
+#include "timeline.hpp"
+#include "utility.hpp"
 
+#include <algorithm>
 #include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
 
 // GLOBAL STATE
 //
 // Command line options are stored in global variables:
 
-int command     = 0;   // 'c' or 'd'
+int command     = 0;   // 'c', 'd', 'e' or 'p'
 int memoryLimit = 128; // memory limit in MiB
 int orderLimit  = 4;   //  order limit in bytes
+int mixOrderLimit = -1; // order limit of the second model or -1
+const char * dictionaryPath = NULL; // preset dictionary file or NULL
+int jobs        = 1;   // number of worker threads
+int coder       = CODER_RC; // coder for compression
+int lanes       = 1;   // number of blocks interleaved in one thread
+int nodeAllocator = ALLOC_BUMP; // node allocator
+int relayoutPeriod = -1; // relayout period in MiB, 0 when full, -1 never
+int minVisits   = 0;   // updates a node needs before it's extended
+bool learnNoise = false; // send incompressible blocks through the model
+int engine      = ENGINE_PPM; // engine for compression
+bool verbose    = false; // print coding statistics
+bool quiet      = false; // print nothing but errors
+int progressFd  = -1;  // file descriptor for JSON progress or -1
+bool perfCounters = false; // count with the hardware counters
+bool timePhases = false; // time input, model, coder and output
+int costMapWindow = 0; // cost map window in KiB, 0 for no map
+int timelineInterval = 0; // timeline interval in KiB, 0 for none
+int estimateSamples = 0; // samples estimated by crook e, 0 for all
 
 // COMPRESS AND DECOMPRESS
 //
 // The compressed file is prefixed with it's uncompressed length; this
-// is why the program will not work with unseekable files.
+// is why the program will not work with unseekable files.  Next comes
+// the hash of the preset dictionary, see "dictionary.hpp", a byte with
+// the id of the coder, one of CODER_*, a byte with the number of lanes
+// and one with the id of the engine, one of ENGINE_*.  A single lane is
+// stored in blocks as described in "blocks.hpp", several lanes as
+// described in "lanes.hpp".
+//
+// The loops are templates over the model and the coder so that every
+// combination gets its own specialized loop, with the bytes coded by
+// the kernels in "kernel.hpp".  Once the model is full the rest of the
+// input goes through a second loop that doesn't try to grow it.
+//
+// Problems with the header are reported with a Status, I/O errors are
+// left for the caller to find with ferror, except for those of the
+// estimates below, which don't read through the FILE.
+
+enum Status
+{
+    OK,
+    WRONG_DICTIONARY, // the file was compressed with another dictionary
+    WRONG_SNAPSHOT,   // the snapshot was saved with other -m/-O/-o/-a
+    UNKNOWN_CODER,    // the file is corrupted or from a newer crook
+    READ_ERROR,       // crook e couldn't read the input, see errno
+    TOO_LARGE         // crook e without -s was given 4 GiB or more
+};
+
+// The header as read by ReadHeader, before any models exist since the
+// number of lanes decides how many are needed.
+
+struct Header
+{
+    U32 textLength;
+    U32 hash;  // of the dictionary
+    int coder; // one of CODER_*
+    int lanes; // number of interleaved blocks, see "lanes.hpp"
+    int engine; // one of ENGINE_*
+};
+
+Status ReadHeader(FILE * codeFile, Dictionary & dictionary, Header & header)
+{
+    header.textLength = GetU32(codeFile);
+    header.hash = GetU32(codeFile);
+    if (header.hash != dictionary.GetHash())
+        return WRONG_DICTIONARY;
+    header.coder = getc(codeFile);
+    header.lanes = getc(codeFile);
+    header.engine = getc(codeFile);
+    if (header.coder < 0 || header.coder >= NUM_CODERS ||
+        header.lanes < 1 || header.lanes > LANES_LIMIT ||
+        header.engine < 0 || header.engine >= NUM_ENGINES)
+        return UNKNOWN_CODER;
+    return OK;
+}
+
+template <class Model>
+bool PrimeLanes(Model ** models, int numLanes, Dictionary & dictionary)
+{
+    for (int i = 0; i != numLanes; ++i)
+    {
+        if (!dictionary.Prime(*models[i]))
+            return false;
+    }
+    return true;
+}
+
+template <class Coder, class Model>
+void Encode(FILE * textFile, FILE * codeFile, Model ** models,
+            Header & header, ProgressBar & bar)
+{
+    if (header.lanes == 1)
+        EncodeBlocks<Coder>(textFile, codeFile, *models[0],
+                            header.textLength, bar);
+    else
+        EncodeLanes<Coder>(textFile, codeFile, models, header.lanes,
+                           header.textLength, bar);
+}
+
+template <class Coder, class Model>
+void Decode(FILE * codeFile, FILE * textFile, Model ** models,
+            Header & header, ProgressBar & bar)
+{
+    if (header.lanes == 1)
+        DecodeBlocks<Coder>(codeFile, textFile, *models[0],
+                            header.textLength, bar);
+    else
+        DecodeLanes<Coder>(codeFile, textFile, models, header.lanes,
+                           header.textLength, bar);
+}
 
-void Compress(FILE * textFile, FILE * codeFile)
+template <class Model>
+Status Compress(FILE * textFile, FILE * codeFile, Model ** models,
+                Header & header, Dictionary & dictionary, ProgressBar & bar)
 {
     fseek(textFile, 0, SEEK_END);
-    U32 textLength = ftell(textFile);
+    header.textLength = ftell(textFile);
     fseek(textFile, 0, SEEK_SET);
+    header.hash = dictionary.GetHash();
+    header.coder = coder;
 
-    putc(textLength >> 24, codeFile);
-    putc(textLength >> 16, codeFile);
-    putc(textLength >>  8, codeFile);
-    putc(textLength >>  0, codeFile);
+    PutU32(header.textLength, codeFile);
+    PutU32(header.hash, codeFile);
+    putc(header.coder, codeFile);
+    putc(header.lanes, codeFile);
+    putc(header.engine, codeFile);
+    if (!PrimeLanes(models, header.lanes, dictionary))
+        return WRONG_SNAPSHOT;
 
-    ProgressBar bar;
-    Encoder rc(codeFile);
-    PPM ppm;
-    for (U32 processed = 0; processed != textLength; ++processed)
+    if (coder == CODER_RANS)
+        Encode<RansEncoder>(textFile, codeFile, models, header, bar);
+    else if (coder == CODER_RC64)
+        Encode<Encoder64>(textFile, codeFile, models, header, bar);
+    else
+        Encode<Encoder>(textFile, codeFile, models, header, bar);
+    bar.Finish(header.textLength, ftell(codeFile),
+               GetUsedMemory(models, header.lanes));
+    return OK;
+}
+
+template <class Model>
+Status Decompress(FILE * codeFile, FILE * textFile, Model ** models,
+                  Header & header, Dictionary & dictionary, ProgressBar & bar)
+{
+    if (!PrimeLanes(models, header.lanes, dictionary))
+        return WRONG_SNAPSHOT;
+
+    if (header.coder == CODER_RANS)
+        Decode<RansDecoder>(codeFile, textFile, models, header, bar);
+    else if (header.coder == CODER_RC64)
+        Decode<Decoder64>(codeFile, textFile, models, header, bar);
+    else
+        Decode<Decoder>(codeFile, textFile, models, header, bar);
+    bar.Finish(header.textLength, ftell(codeFile),
+               GetUsedMemory(models, header.lanes));
+    return OK;
+}
+
+// SAVE A PRIMED MODEL
+//
+// The model is primed with the -D dictionary, if any, and then with
+// the input, if any; see "snapshot.hpp".
+
+template <class Model>
+Status Prime(FILE * dictionaryFile, FILE * snapshotFile, Model & model,
+             Dictionary & dictionary)
+{
+    if (!dictionary.Prime(model))
+        return WRONG_SNAPSHOT;
+
+    Dictionary more(dictionary.GetHash());
+    if (dictionaryFile != NULL && !more.Load(dictionaryFile))
+        return OK;
+    more.Train(model);
+
+    Snapshot snapshot;
+    snapshot.Create(snapshotFile, more.GetHash());
+    model.Save(snapshot);
+    snapshot.Finish();
+    return OK;
+}
+
+template <class Model>
+Status Process(int command, FILE * input, FILE * output, Model ** models,
+               Header & header, Dictionary & dictionary, ProgressBar & bar)
+{
+    if (command == 'c')
+        return Compress(input, output, models, header, dictionary, bar);
+    else if (command == 'd')
+        return Decompress(input, output, models, header, dictionary, bar);
+    else
+        return Prime(input, output, *models[0], dictionary);
+}
+
+// Makes the models of each engine.
+
+PPM * NewModel(PPM *)
+{
+    return new PPM(memoryLimit, orderLimit, nodeAllocator, minVisits);
+}
+
+Ensemble * NewModel(Ensemble *)
+{
+    return new Ensemble(memoryLimit, orderLimit, mixOrderLimit,
+                        nodeAllocator, minVisits);
+}
+
+template <int ORDER> Direct<ORDER> * NewModel(Direct<ORDER> *)
+{
+    return new Direct<ORDER>;
+}
+
+BytePPM * NewModel(BytePPM *)
+{
+    return new BytePPM(memoryLimit, orderLimit);
+}
+
+template <class First>
+Either<First, BytePPM> * NewModel(Either<First, BytePPM> *)
+{
+    return new Either<First, BytePPM>(NewModel((First *)NULL),
+                                      NewModel((BytePPM *)NULL));
+}
+
+// ESTIMATE THE COMPRESSED SIZE
+//
+// See "estimate.hpp".  The header is counted, the lanes aren't: the
+// estimate is for a single one, so main rejects -i with "e".
+
+const U32 HEADER_SIZE = 11;
+
+// The samples of a file, shared by the threads that estimate them.
+struct Samples
+{
+    int fd;
+    Dictionary * dictionary;
+    vector<U64> starts;
+    vector<double> bpc;    // of each sample
+    vector<U32> memory;    // used by each sample's model
+    vector<U32> limit;     // the same for every sample's model
+    vector<Status> status; // of each sample, read after the joins
+    vector<int> error;     // errno of each READ_ERROR
+    int next;
+};
+
+template <class Model> void * SampleWorker(void * arg)
+{
+    Samples & samples = *(Samples *)arg;
+    ProgressBar bar("", true, true);
+    for (;;)
     {
-        bar.Update(processed, textLength, ppm.GetUsedMemory());
+        int i = __sync_fetch_and_add(&samples.next, 1);
+        if (i >= (int)samples.starts.size())
+            return NULL;
+        Model * model = NewModel((Model *)NULL);
+        double codeLength;
+        if (!samples.dictionary->Prime(*model))
+            samples.status[i] = WRONG_SNAPSHOT;
+        else if (!EstimateBlocks(samples.fd, samples.starts[i],
+                                 ESTIMATE_SAMPLE, *model, bar, codeLength))
+        {
+            samples.error[i] = errno;
+            samples.status[i] = READ_ERROR;
+        }
+        else
+        {
+            samples.bpc[i] = 8 * codeLength / ESTIMATE_SAMPLE;
+            samples.memory[i] = model->GetUsedMemory();
+            samples.limit[i] = model->GetMemoryLimit();
+        }
+        delete model;
+    }
+}
+
+template <class Model>
+Status Estimate(FILE * textFile, Dictionary & dictionary, ProgressBar & bar)
+{
+    struct stat text;
+    if (fstat(fileno(textFile), &text) != 0)
+        return READ_ERROR;
+    U64 textLength = text.st_size;
+
+    // samples that would cover the whole file might as well be it
+    int numSamples = estimateSamples;
+    if ((U64)numSamples * ESTIMATE_SAMPLE >= textLength)
+        numSamples = 0;
 
-        U32 c = getc(textFile);
-        for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+    if (numSamples == 0)
+    {
+        if (textLength >> 32 != 0)
+            return TOO_LARGE;
+        Model * model = NewModel((Model *)NULL);
+        bar.SetMemoryLimit(model->GetMemoryLimit());
+        Status status = OK;
+        double codeLength;
+        if (!dictionary.Prime(*model))
+            status = WRONG_SNAPSHOT;
+        else if (!EstimateBlocks(fileno(textFile), 0, textLength, *model,
+                                 bar, codeLength))
+            status = READ_ERROR;
+        else
+            bar.Estimated(textLength, HEADER_SIZE + codeLength, 0, 0,
+                          model->GetUsedMemory());
+        delete model;
+        return status;
+    }
+
+    Samples samples;
+    samples.fd = fileno(textFile);
+    samples.dictionary = &dictionary;
+    samples.starts = SampleStarts(textLength, ESTIMATE_SAMPLE, numSamples);
+    samples.bpc.resize(numSamples);
+    samples.memory.resize(numSamples);
+    samples.limit.resize(numSamples);
+    samples.status.resize(numSamples, OK);
+    samples.error.resize(numSamples, 0);
+    samples.next = 0;
+
+    int numWorkers = min(jobs, numSamples);
+    vector<pthread_t> workers(numWorkers);
+    for (int i = 1; i < numWorkers; ++i)
+        pthread_create(&workers[i], NULL, SampleWorker<Model>, &samples);
+    SampleWorker<Model>(&samples);
+    for (int i = 1; i < numWorkers; ++i)
+        pthread_join(workers[i], NULL);
+
+    for (int i = 0; i < numSamples; ++i)
+        if (samples.status[i] != OK)
         {
-            U32 p1 = ppm.Predict();
-            if (c & mask)
-            {
-                rc.Encode<1>(p1);
-                ppm.Update<1>();
-            }
-            else
-            {
-                rc.Encode<0>(p1);
-                ppm.Update<0>();
-            }
-            rc.Normalize();
+            errno = samples.error[i];
+            return samples.status[i];
         }
+    bar.SetMemoryLimit(samples.limit[0]);
+    double mean, margin;
+    MeanInterval(samples.bpc, (double)numSamples * ESTIMATE_SAMPLE / textLength,
+                 mean, margin);
+    bar.Estimated(textLength, HEADER_SIZE + mean * textLength / 8, margin,
+                  numSamples, *max_element(samples.memory.begin(),
+                                           samples.memory.end()));
+    return OK;
+}
+
+// Makes a model for each lane and hands them to the Process template
+// above, or estimates.
+
+template <class Model>
+Status Process(int command, FILE * input, FILE * output, Header & header,
+               Dictionary & dictionary, ProgressBar & bar)
+{
+    if (command == 'e')
+        return Estimate<Model>(input, dictionary, bar);
+
+    Model * models[LANES_LIMIT];
+    for (int i = 0; i != header.lanes; ++i)
+        models[i] = NewModel((Model *)NULL);
+    bar.SetMemoryLimit(GetMemoryLimit(models, header.lanes));
+    Status status = Process(command, input, output, models, header,
+                            dictionary, bar);
+    for (int i = 0; i != header.lanes; ++i)
+        delete models[i];
+    return status;
+}
+
+Status Process(int command, FILE * input, FILE * output,
+               Dictionary & dictionary, ProgressBar & bar)
+{
+    Header header;
+    // the bytewise engine codes whole bytes, it can't be interleaved
+    header.engine = engine;
+    header.lanes = (command == 'c' && engine < ENGINE_BYTES) ? lanes : 1;
+    if (command == 'd')
+    {
+        Status status = ReadHeader(input, dictionary, header);
+        if (status != OK)
+            return status;
     }
-    rc.FlushBuffer();
-    bar.Finish(textLength, ftell(codeFile), ppm.GetUsedMemory());
+
+    if (header.engine == ENGINE_ORDER1)
+        return Process<Direct<1> >(command, input, output, header, dictionary, bar);
+    else if (header.engine == ENGINE_ORDER2)
+        return Process<Direct<2> >(command, input, output, header, dictionary, bar);
+    else if (header.engine == ENGINE_BYTES)
+        return Process<BytePPM>(command, input, output, header, dictionary, bar);
+    else if (header.engine == ENGINE_EITHER && mixOrderLimit < 0)
+        return Process<Either<PPM, BytePPM> >(command, input, output, header,
+                                              dictionary, bar);
+    else if (header.engine == ENGINE_EITHER)
+        return Process<Either<Ensemble, BytePPM> >(command, input, output,
+                                                   header, dictionary, bar);
+    else if (mixOrderLimit < 0)
+        return Process<PPM>(command, input, output, header, dictionary, bar);
+    else
+        return Process<Ensemble>(command, input, output, header, dictionary, bar);
 }
 
-void Decompress(FILE * codeFile, FILE * textFile)
+// BATCH MODE
+//
+// Any number of INPUT OUTPUT pairs may be given, or just INPUTs to
+// crook e, and with -jN they are processed by N worker threads.  Each
+// file gets a fresh model.  crook e -s works on one file at a time
+// and gives the threads its samples instead.
+//
+// The workers share the primed model by mapping the same snapshot:
+// the mapping is private so a worker's writes go to its own copies of
+// the pages it touches, while new nodes go to the rest of its pool.
+// Memory use thus grows with the data each worker adds rather than
+// with the size of the dictionary.  A plain dictionary is turned into
+// a temporary snapshot first.
+
+struct Batch
 {
-    U32 textLength = 0;
-    textLength += getc(codeFile) << 24;
-    textLength += getc(codeFile) << 16;
-    textLength += getc(codeFile) <<  8;
-    textLength += getc(codeFile) <<  0;
+    const char * program;
+    char ** paths;
+    int stride;    // paths per job: INPUT OUTPUT, or INPUT for crook e
+    int numJobs;
+    int next;
+    bool failed;
+    Dictionary * dictionary;
+};
 
-    ProgressBar bar;
-    Decoder rc(codeFile);
-    PPM ppm;
-    rc.FillBuffer();
-    for (U32 processed = 0; processed != textLength; ++processed)
+bool Run(Batch & batch, const char * inputPath, const char * outputPath)
+{
+    const char * program = batch.program;
+
+    FILE * input = fopen(inputPath, "rb");
+    if (input == NULL)
     {
-        bar.Update(processed, textLength, ppm.GetUsedMemory());
+        fprintf(stderr, "%s: cannot open '%s' (%s)\n",
+                program, inputPath, strerror(errno));
+        return false;
+    }
 
-        U32 c = 0;
-        for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+    // crook e has no output
+    FILE * output = outputPath != NULL ? fopen(outputPath, "wb") : NULL;
+    if (output == NULL && outputPath != NULL)
+    {
+        fprintf(stderr, "%s: cannot open '%s' (%s)\n",
+                program, outputPath, strerror(errno));
+        fclose(input);
+        return false;
+    }
+
+    // the cost map goes next to the compressed file
+    FILE * mapFile = NULL;
+    string mapPath = outputPath != NULL ? string(outputPath) + ".map" : "";
+    if (command == 'c' && costMapWindow != 0)
+    {
+        mapFile = fopen(mapPath.c_str(), "w");
+        if (mapFile == NULL)
         {
-            U32 p1 = ppm.Predict();
-            if (rc.Decode(p1))
-            {
-                ppm.Update<1>();
-                c |= mask;
-            }
-            else
-            {
-                ppm.Update<0>();
-            }
-            rc.Normalize();
+            fprintf(stderr, "%s: cannot open '%s' (%s)\n",
+                    program, mapPath.c_str(), strerror(errno));
+            fclose(input);
+            fclose(output);
+            return false;
         }
-        putc(c, textFile);
     }
-    bar.Finish(textLength, ftell(codeFile), ppm.GetUsedMemory());
+    CostMap * map = mapFile != NULL ? new CostMap(mapFile, costMapWindow << 10)
+                                    : NULL;
+    costMap = map;
+
+    FILE * timelineFile = NULL;
+    string timelinePath = outputPath != NULL ? string(outputPath) + ".timeline"
+                                             : "";
+    if (command == 'c' && timelineInterval != 0)
+    {
+        timelineFile = fopen(timelinePath.c_str(), "w");
+        if (timelineFile == NULL)
+        {
+            fprintf(stderr, "%s: cannot open '%s' (%s)\n",
+                    program, timelinePath.c_str(), strerror(errno));
+            delete map;
+            if (mapFile != NULL)
+                fclose(mapFile);
+            fclose(input);
+            fclose(output);
+            return false;
+        }
+    }
+    Timeline * samples = timelineFile != NULL
+                       ? new Timeline(timelineFile, (U64)timelineInterval << 10)
+                       : NULL;
+    timeline = samples;
+
+    ProgressBar bar(inputPath, batch.numJobs > 1);
+    Statistics stats;
+    statistics = verbose ? &stats : NULL;
+    PerfCounters * counters = perfCounters ? new PerfCounters : NULL;
+    Phases times;
+    phases = timePhases ? &times : NULL;
+    times.Start();
+    if (counters != NULL)
+        counters->Start();
+    Status status = Process(command, input, output, *batch.dictionary, bar);
+    if (counters != NULL)
+        counters->Stop();
+    times.Stop();
+    statistics = NULL;
+    phases = NULL;
+    costMap = NULL;
+    timeline = NULL;
+    bool ok = false;
+
+#ifdef LOCALITY_STATS
+    localityStats.Print(inputPath);
+    localityStats = LocalityStats();
+#endif
+
+    if (status == WRONG_DICTIONARY)
+        fprintf(stderr, "%s: '%s' was compressed with another dictionary\n",
+                program, inputPath);
+    else if (status == WRONG_SNAPSHOT)
+        fprintf(stderr, "%s: '%s' was saved with other -m/-O/-o/-a options\n",
+                program, dictionaryPath);
+    else if (status == UNKNOWN_CODER)
+        fprintf(stderr, "%s: '%s' is corrupted or uses an unknown coder\n",
+                program, inputPath);
+    else if (status == TOO_LARGE)
+        fprintf(stderr, "%s: '%s' is too large to be estimated whole, use -s\n",
+                program, inputPath);
+    else if (status == READ_ERROR || ferror(input))
+        fprintf(stderr, "%s: cannot read from '%s' (%s)\n",
+                program, inputPath, strerror(errno));
+    else if (output != NULL && (fflush(output) != 0 || ferror(output)))
+        fprintf(stderr, "%s: cannot write to '%s' (%s)\n",
+                program, outputPath, strerror(errno));
+    else
+        ok = true;
+
+    if (ok && verbose)
+        stats.Print(inputPath);
+    if (ok && counters != NULL)
+    {
+        // per byte of the uncompressed data
+        struct stat text;
+        fstat(fileno(command == 'd' ? output : input), &text);
+        counters->Print(inputPath, text.st_size);
+    }
+    delete counters;
+    if (ok && timePhases)
+        times.Print(inputPath);
+
+    if (map != NULL)
+    {
+        map->Finish();
+        delete map;
+        if (fclose(mapFile) != 0 && ok)
+        {
+            fprintf(stderr, "%s: cannot write to '%s' (%s)\n",
+                    program, mapPath.c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+    if (samples != NULL)
+    {
+        delete samples;
+        if (fclose(timelineFile) != 0 && ok)
+        {
+            fprintf(stderr, "%s: cannot write to '%s' (%s)\n",
+                    program, timelinePath.c_str(), strerror(errno));
+            ok = false;
+        }
+    }
+
+    fclose(input);
+    if (output != NULL)
+        fclose(output);
+    return ok;
+}
+
+void * Worker(void * arg)
+{
+    Batch & batch = *(Batch *)arg;
+    for (;;)
+    {
+        int job = __sync_fetch_and_add(&batch.next, 1);
+        if (job >= batch.numJobs)
+            return NULL;
+        char ** paths = batch.paths + batch.stride * job;
+        if (!Run(batch, paths[0], batch.stride == 2 ? paths[1] : NULL))
+            batch.failed = true;
+    }
+}
+
+// COMPRESSION LEVELS
+//
+// -1 to -9 are shorthands for the engine and the model options; the
+// options after a level override it.  Level 5 is the default.
+
+void SetLevel(int level)
+{
+    static const struct
+    {
+        int engine, memory, order, mixOrder;
+    }
+    levels[10] =
+    {
+        { ENGINE_PPM,       0, 0, -1 },
+        { ENGINE_ORDER1,  128, 4, -1 }, // 1
+        { ENGINE_ORDER2,  128, 4, -1 }, // 2
+        { ENGINE_PPM,      32, 2, -1 }, // 3
+        { ENGINE_PPM,      64, 3, -1 }, // 4
+        { ENGINE_PPM,     128, 4, -1 }, // 5
+        { ENGINE_PPM,     256, 5, -1 }, // 6
+        { ENGINE_PPM,     512, 6, -1 }, // 7
+        { ENGINE_PPM,     512, 6,  2 }, // 8
+        { ENGINE_PPM,    1024, 8,  3 }, // 9
+    };
+    engine        = levels[level].engine;
+    memoryLimit   = levels[level].memory;
+    orderLimit    = levels[level].order;
+    mixOrderLimit = levels[level].mixOrder;
 }
 
+// values of the long options, beyond those of the short ones
+const int OPT_PERF   = 256;
+const int OPT_PHASES = 257;
+
 int main(int argc, char ** argv)
 {
     bool help = false;
     bool version = false;
 
+    static const LongOption longOptions[] =
+    {
+        { "perf",   OPT_PERF   },
+        { "phases", OPT_PHASES },
+        { NULL,     0          },
+    };
+
     int c;
-    while ((c = getopt(argc, argv, "hVvqm:O:")) != -1)
+    while ((c = getopt(argc, argv, "hVvqn123456789m:O:o:D:j:e:i:a:r:k:b:J:w:t:s:",
+                       longOptions)) != -1)
     {
         if      (c == 'h') help    = true;
         else if (c == 'V') version = true;
-        else if (c == 'm' || c == 'O')
+        else if (c == 'v') verbose = true;
+        else if (c == 'q') quiet   = true;
+        else if (c == 'n') learnNoise = true;
+        else if (c == OPT_PERF) perfCounters = true;
+        else if (c == OPT_PHASES) timePhases = true;
+        else if (c >= '1' && c <= '9') SetLevel(c - '0');
+        else if (c == 'D') dictionaryPath = optarg;
+        else if (c == 'm' || c == 'O' || c == 'o' || c == 'j' || c == 'e' ||
+                 c == 'i' || c == 'a' || c == 'r' || c == 'k' || c == 'b' ||
+                 c == 'J' || c == 'w' || c == 't' || c == 's')
         {
             errno = 0;
             char * rest;
             long val = strtol(optarg, &rest, 10);
-            if (errno != 0 || *rest != '\0' || val < 0)
+            if (errno != 0 || *rest != '\0' || val < 0 ||
+                (c == 'e' && val >= NUM_CODERS) ||
+                (c == 'i' && (val < 1 || val > LANES_LIMIT)) ||
+                (c == 'a' && val >= NUM_ALLOCATORS) ||
+                (c == 'b' && val > 2) ||
+                (c == 'k' && val > PPM_VISITS_LIMIT) ||
+                (c == 'w' && val >= 1 << 22) ||
+                (c == 's' && (val == 1 || val > 1 << 20)))
             {
                 fprintf(stderr,
                         "%s: invalid argument '%s' for option '%c'\n",
                         argv[0], optarg, c);
                 return 1;
             }
-            if (c == 'm') memoryLimit = val;
-            else          orderLimit  = val;
+            if      (c == 'm') memoryLimit   = val;
+            else if (c == 'O') orderLimit    = val;
+            else if (c == 'o') mixOrderLimit = val;
+            else if (c == 'j') jobs          = max(1L, val);
+            else if (c == 'e') coder         = val;
+            else if (c == 'i') lanes         = val;
+            else if (c == 'a') nodeAllocator = val;
+            else if (c == 'r') relayoutPeriod = val;
+            else if (c == 'k') minVisits     = val;
+            else if (c == 'J') progressFd    = val;
+            else if (c == 'w') costMapWindow = val;
+            else if (c == 't') timelineInterval = val;
+            else if (c == 's') estimateSamples = val;
+            else               engine = val == 0 ? ENGINE_PPM :
+                                        val == 1 ? ENGINE_BYTES : ENGINE_EITHER;
         }
         else return 1;
     }
 
+    // a -J reader that has gone away must fail the write, which stops
+    // the reports (see "progress_bar.hpp"), not kill crook mid-file
+    if (progressFd >= 0)
+        signal(SIGPIPE, SIG_IGN);
+
     help = help || (!version && optind == argc);
 
     if (help)
@@ -135,17 +738,55 @@ int main(int argc, char ** argv)
              "  crook c INPUT OUTPUT\n"
              "To decompress\n"
              "  crook d INPUT OUTPUT\n"
+             "To save a model primed with a dictionary\n"
+             "  crook p DICTIONARY SNAPSHOT\n"
+             "To estimate how well a file compresses without compressing it\n"
+             "  crook e INPUT  (as if compressed with -i1)\n"
+             "More INPUT OUTPUT pairs, or INPUTs, may follow the first one.\n"
              "Existing output files are overwritten.\n"
              "\n"
              "Options:\n"
              "  -h   print this message\n"
              "  -V   print program version\n"
+             "  -v   print how the bits were spent at the end\n"
+             "  -q   print nothing but errors\n"
+             "  -1 .. -9  compress faster or better (default: -5); -1 and -2\n"
+             "       use an order-1 or order-2 table instead of the tree\n"
              "  -mN  use at most N megabytes of memory (default: 128)\n"
              "  -ON  use at most N previous bytes as context (default: 4)\n"
-             "Options may be specified anywhere on the command line.\n"
+             "  -oN  mix in a second model using at most N bytes as context\n"
+             "  -DF  prime the model with the file F, a dictionary or snapshot\n"
+             "  -jN  process N pairs of files at a time (default: 1)\n"
+             "  -eN  compress with coder N: 0 arithmetic, 1 rANS,\n"
+             "       2 64-bit arithmetic (default: 0)\n"
+             "  -iN  split the input into N blocks coded in lock-step by one\n"
+             "       thread, each with its own -m of memory (1-4, default: 1)\n"
+             "  -aN  allocate nodes with allocator N: 0 at the top of the pool,\n"
+             "       1 near their parents (default: 0)\n"
+             "  -rN  lay the model out afresh every N megabytes of input while\n"
+             "       it grows and once when it's full, or only then if N is 0\n"
+             "  -kN  extend a context only once it has been seen N times\n"
+             "       (0-30, default: 0)\n"
+             "  -n   model blocks that look incompressible too, slower but a\n"
+             "       second copy of the same compressed file then compresses\n"
+             "  -bN  1: code whole bytes with escapes instead of the tree,\n"
+             "       2: try both on every block and keep the shorter code\n"
+             "  -JN  write progress as JSON lines to file descriptor N\n"
+             "  -wN  write the cost of every N KiB of input to OUTPUT.map\n"
+             "       (a single lane, not with -i)\n"
+             "  -tN  write the model's memory every N KiB of input to OUTPUT.timeline\n"
+             "       (a single lane, not with -i)\n"
+             "  -sN  estimate from N samples of 4 MiB spread over the input,\n"
+             "       -j at a time, with a 95% confidence interval (N >= 2)\n"
+             "  --perf  print hardware performance counts per byte at the end\n"
+             "  --phases  print the time spent on I/O, the model and the coder\n"
+             "Options may be specified anywhere on the command line, later ones\n"
+             "override a level.\n"
              "\n"
              "Warning: identical options must be passed both when compressing and\n"
-             "when decompressing, otherwise decompression will fail silently.\n");
+             "when decompressing, otherwise decompression will fail silently.\n"
+             "Only the engine of -1 .. -9 and -b, -e and -i are stored in the\n"
+             "compressed file and may be omitted.\n");
     }
 
     if (help || version)
@@ -154,54 +795,106 @@ int main(int argc, char ** argv)
         return 0;
     }
 
-    if ((argv[optind][0] != 'c' && argv[optind][0] != 'd') ||
-        argv[optind][1] != 0)
+    if (strchr("cdep", argv[optind][0]) == NULL || argv[optind][1] != 0)
     {
         fprintf(stderr, "%s: unrecognized command '%s'\n",
                 argv[0], argv[optind]);
         return 1;
     }
 
-    if (optind + 2 >= argc)
+    command = argv[optind][0];
+    int stride = command == 'e' ? 1 : 2;
+
+    // an estimate is for a single lane, see "estimate.hpp"
+    if (command == 'e' && lanes != 1)
     {
-        fprintf(stderr, "%s: not enough arguments given\n", argv[0]);
+        fprintf(stderr, "%s: -i can't be used with e, it estimates -i1\n",
+                argv[0]);
         return 1;
     }
 
-    command = argv[optind][0];
-
-    FILE * input = fopen(argv[optind+1], "rb");
-    if (input == NULL)
+    // the cost map follows a single lane, see "costmap.hpp"
+    if (lanes != 1 && costMapWindow != 0)
     {
-        fprintf(stderr, "%s: cannot open '%s' (%s)\n",
-                argv[0], argv[optind+1], strerror(errno));
+        fprintf(stderr, "%s: -i can't be used with -w, it maps -i1\n",
+                argv[0]);
         return 1;
     }
 
-    FILE * output = fopen(argv[optind+2], "wb");
-    if (output == NULL)
+    // and so does the timeline, see "timeline.hpp"
+    if (lanes != 1 && timelineInterval != 0)
     {
-        fprintf(stderr, "%s: cannot open '%s' (%s)\n",
-                argv[0], argv[optind+2], strerror(errno));
+        fprintf(stderr, "%s: -i can't be used with -t, it follows -i1\n",
+                argv[0]);
         return 1;
     }
 
-    if (command == 'c')
-        Compress(input, output);
-    else
-        Decompress(input, output);
-
-    if (ferror(input))
+    if (argc - optind - 1 < stride)
     {
-        fprintf(stderr, "%s: cannot read from '%s' (%s)\n",
-                argv[0], argv[optind+1], strerror(errno));
+        fprintf(stderr, "%s: not enough arguments given\n", argv[0]);
         return 1;
     }
 
-    if (ferror(output))
+    if ((argc - optind - 1) % stride != 0)
     {
-        fprintf(stderr, "%s: cannot write to '%s' (%s)\n",
-                argv[0], argv[optind+2], strerror(errno));
+        fprintf(stderr, "%s: INPUT without OUTPUT\n", argv[0]);
         return 1;
     }
+
+    Dictionary dictionary;
+    if (dictionaryPath != NULL)
+    {
+        FILE * dictionaryFile = fopen(dictionaryPath, "rb");
+        if (dictionaryFile == NULL)
+        {
+            fprintf(stderr, "%s: cannot open '%s' (%s)\n",
+                    argv[0], dictionaryPath, strerror(errno));
+            return 1;
+        }
+        if (!dictionary.Open(dictionaryFile))
+        {
+            fprintf(stderr, "%s: cannot read from '%s' (%s)\n",
+                    argv[0], dictionaryPath, strerror(errno));
+            return 1;
+        }
+    }
+
+    Batch batch;
+    batch.program    = argv[0];
+    batch.paths      = argv + optind + 1;
+    batch.stride     = stride;
+    batch.numJobs    = (argc - optind - 1) / stride;
+    batch.next       = 0;
+    batch.failed     = false;
+    batch.dictionary = &dictionary;
+
+    Dictionary shared;
+    if (dictionaryPath != NULL && !dictionary.IsSnapshot() &&
+        batch.numJobs > 1 && jobs > 1)
+    {
+        FILE * snapshotFile = tmpfile();
+        ProgressBar bar(dictionaryPath, true);
+        if (snapshotFile == NULL ||
+            Process('p', NULL, snapshotFile, dictionary, bar) != OK ||
+            fflush(snapshotFile) != 0 || ferror(snapshotFile) ||
+            !shared.Open(snapshotFile))
+        {
+            fprintf(stderr, "%s: cannot save a snapshot of '%s' (%s)\n",
+                    argv[0], dictionaryPath, strerror(errno));
+            return 1;
+        }
+        batch.dictionary = &shared;
+    }
+
+    // the samples of crook e -s have the threads to themselves
+    int numWorkers = command == 'e' && estimateSamples != 0
+                   ? 1 : min(jobs, batch.numJobs);
+    vector<pthread_t> workers(numWorkers);
+    for (int i = 1; i < numWorkers; ++i)
+        pthread_create(&workers[i], NULL, Worker, &batch);
+    Worker(&batch);
+    for (int i = 1; i < numWorkers; ++i)
+        pthread_join(workers[i], NULL);
+
+    return batch.failed ? 1 : 0;
 }
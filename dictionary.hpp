@@ -0,0 +1,118 @@
+// THE PRESET DICTIONARY
+//
+// Small files compress badly because the model starts out knowing
+// nothing.  With the option -D the model is first trained on the
+// contents of a dictionary file, exactly as if the dictionary had
+// been compressed before the actual input but without running the
+// coder.  The decompressor must do the same, so the compressed file
+// stores a hash of the dictionary and decompression refuses to run
+// with a different one.
+//
+// The hash is 32-bit FNV-1a.  Without a dictionary it is the hash of
+// the empty string which is fine since an empty dictionary is the
+// same as none at all.
+//
+// The dictionary may also be a snapshot of an already primed model,
+// see "snapshot.hpp".  A snapshot stores the hash of the dictionaries
+// it was primed with, hashed as if they were concatenated, so it is
+// interchangeable with the dictionaries themselves.
+
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+#include "config.hpp"
+
+#include "snapshot.hpp"
+
+#include <cstdlib>
+
+U32 Hash(const U8 * data, U32 length, U32 h = 2166136261u)
+{
+    for (U32 i = 0; i != length; ++i)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+class Dictionary
+{
+    U8 * data;
+    U32 length;
+    U32 hash;
+    bool isSnapshot;
+    Snapshot snapshot;
+public:
+    // The hash starts from seed, i.e. the hash of whatever the model
+    // has already been primed with.
+    Dictionary(U32 seed = Hash(NULL, 0))
+        : data(NULL), length(0), hash(seed), isSnapshot(false) {}
+
+    ~Dictionary()
+    {
+        free(data);
+    }
+
+    // Reads the whole file into memory, returns false on I/O errors.
+    bool Load(FILE * file)
+    {
+        fseek(file, 0, SEEK_END);
+        length = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data = (U8 *) malloc(length + 1);
+        if (fread(data, 1, length, file) != length || ferror(file))
+            return false;
+        hash = Hash(data, length, hash);
+        return true;
+    }
+
+    // Like Load but also accepts snapshots.  Only their header is read,
+    // the file must stay open until the model has been primed.
+    bool Open(FILE * file)
+    {
+        if (!snapshot.Open(file))
+            return Load(file);
+        isSnapshot = true;
+        hash = snapshot.GetU32();
+        return true;
+    }
+
+    U32 GetHash()
+    {
+        return hash;
+    }
+
+    bool IsSnapshot()
+    {
+        return isSnapshot;
+    }
+
+    // Returns false if the model doesn't fit the snapshot.  The header
+    // is read through a copy so that threads can prime concurrently.
+    template <class Model> bool Prime(Model & model)
+    {
+        if (isSnapshot)
+        {
+            Snapshot reader(snapshot);
+            return model.Load(reader);
+        }
+        Train(model);
+        return true;
+    }
+
+    template <class Model> void Train(Model & model)
+    {
+        for (U32 i = 0; i != length; ++i)
+        {
+            U32 c = data[i];
+            for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+            {
+                model.Predict(); // the mixer learns from its predictions
+                if (c & mask)
+                    model.template Update<1>();
+                else
+                    model.template Update<0>();
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,220 @@
+// THE DIRECT TABLE MODEL
+//
+// The fast levels -1 and -2 trade the tree for a plain table: the
+// context is the last ORDER bytes plus the bits of the current byte
+// seen so far, and it indexes a probability directly.  There's no
+// walk, no inheritance and nothing to allocate, so every bit costs
+// one table lookup and one update; the coder is what's left.  That
+// still comes to about 15 MB/s on a 4 MB text (see "kernel.hpp" for the
+// machine): each bit waits for the previous one through the table row
+// and the coder's range, some 20 cycles.
+//
+// The table has 256^ORDER rows of 256 probabilities with
+// DIRECT_P_BITS of precision, i.e. 128 KiB for order 1 and 32 MiB for
+// order 2.  Probabilities are stored XORed with one half so that the
+// freshly mapped, zeroed table starts out at p = 1/2 without being
+// touched.  They're updated by a fixed fraction 2^-DIRECT_RATE of the
+// error, towards DIRECT_P_SCALE - 1 for a 1 and towards LOW =
+// 2^DIRECT_RATE - 1 for a 0.  The update rounds down, so they stay
+// within LOW .. DIRECT_P_SCALE - 1 - LOW and never reach 0 or 1, which
+// Fit0 in the kernels relies on.
+//
+// The model also provides the rest of the interface the drivers use.
+
+#ifndef DIRECT_HPP
+#define DIRECT_HPP
+
+#include "config.hpp"
+
+#include "memory.hpp"
+#include "snapshot.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+
+#include <cstring>
+
+template <int ORDER> class Direct
+{
+    static const U32 ROWS = 1 << (8 * ORDER);
+    static const U16 HALF = DIRECT_P_SCALE / 2;
+    static const int LOW = (1 << DIRECT_RATE) - 1;
+    static const int HIGH = DIRECT_P_SCALE - 1; // the target of a 1
+
+    U16 * table;
+    U16 * row;     // the row of the last ORDER bytes
+    U32 history;   // the last ORDER bytes
+    U32 partial;   // 1 followed by the bits of the current byte
+public:
+    Direct()
+        : table((U16 *) AllocatePages((U64)ROWS * 256 * sizeof(U16))),
+          row(table),
+          history(0),
+          partial(1) {}
+
+    // A copy of the table, see BitCounter below.
+    Direct(const Direct & other)
+        : table((U16 *) AllocatePages((U64)ROWS * 256 * sizeof(U16))),
+          row(table + other.history * 256),
+          history(other.history),
+          partial(other.partial)
+    {
+        memcpy(table, other.table, (U64)ROWS * 256 * sizeof(U16));
+    }
+
+    ~Direct()
+    {
+        FreePages(table, (U64)ROWS * 256 * sizeof(U16));
+    }
+
+    U32 Predict()
+    {
+        return (U32)(row[partial] ^ HALF) << (PPM_P_BITS - DIRECT_P_BITS);
+    }
+
+    // The bit is a value rather than a template argument here so that
+    // the kernels below don't need a branch on it.
+    void Update(U32 bit)
+    {
+        int p = row[partial] ^ HALF;
+        p += (LOW + (int)bit * (HIGH - LOW) - p) >> DIRECT_RATE;
+        row[partial] = p ^ HALF;
+
+        partial = (partial << 1) + bit;
+        if (partial >= 256)
+        {
+            history = ((history << 8) + partial - 256) & (ROWS - 1);
+            row = table + history * 256;
+            partial = 1;
+        }
+    }
+
+    template <bool bit> void Update()
+    {
+        Update(bit);
+    }
+
+    template <bool bit> void UpdateFrozen()
+    {
+        Update<bit>();
+    }
+
+    // The bytes of the context and the bits of the current one.
+    int GetOrder()
+    {
+        int bits = 0;
+        for (U32 p = partial; p > 1; p >>= 1)
+            ++bits;
+        return 8 * ORDER + bits;
+    }
+
+    // The table never grows, so the drivers needn't switch to Frozen.
+    bool IsFull()
+    {
+        return false;
+    }
+
+    void Relayout() {}
+
+    U32 GetUsedMemory()
+    {
+        return GetUsedBytes() >> 20;
+    }
+
+    U64 GetUsedBytes()
+    {
+        return (U64)ROWS * 256 * sizeof(U16);
+    }
+
+    // -m doesn't apply, the table is all there is
+    U32 GetMemoryLimit()
+    {
+        return GetUsedMemory();
+    }
+
+    // The order comes first; it can't be mistaken for the node count a
+    // PPM snapshot starts with.
+    void Save(Snapshot & snapshot)
+    {
+        snapshot.PutU32(ORDER);
+        snapshot.PutU32(history);
+        snapshot.PutU32(partial);
+        snapshot.PutPool(table, (U64)ROWS * 256 * sizeof(U16));
+    }
+
+    bool Load(Snapshot & snapshot)
+    {
+        if (snapshot.GetU32() != ORDER)
+            return false;
+        history = snapshot.GetU32() & (ROWS - 1);
+        partial = snapshot.GetU32();
+        row = table + history * 256;
+        if (partial == 0 || partial >= 256)
+            return false;
+        U64 size;
+        return snapshot.MapPool(table, (U64)ROWS * 256 * sizeof(U16), size);
+    }
+};
+
+// Byte kernels for the table, preferred over the ones in "kernel.hpp"
+// which branch on every bit.  The coder still gets the bit as a template
+// argument but the compiler turns that choice into conditional moves.
+
+template <class Coder, int ORDER>
+inline void EncodeByte(Coder & rc, Direct<ORDER> & model, U32 c)
+{
+    for (int i = 7; i >= 0; --i)
+    {
+        U32 bit = (c >> i) & 1;
+        U32 p1 = Fit0(model.Predict(), PPM_P_BITS, Coder::P_BITS);
+        if (bit)
+            rc.template Encode<1>(p1);
+        else
+            rc.template Encode<0>(p1);
+        model.Update(bit);
+        rc.Normalize();
+    }
+}
+
+template <class Coder, int ORDER>
+inline U32 DecodeByte(Coder & rc, Direct<ORDER> & model)
+{
+    U32 c = 1;
+    while (c < 0x100)
+    {
+        U32 p1 = Fit0(model.Predict(), PPM_P_BITS, Coder::P_BITS);
+        U32 bit = rc.Decode(p1);
+        model.Update(bit);
+        rc.Normalize();
+        c = (c << 1) + bit;
+    }
+    return c & 0xFF;
+}
+
+// With -v the bits of a block are counted once it's coded, on a copy of
+// the table made before.  Counting them in the kernels above, even
+// behind a test of the statistics, made -1 12% slower, and a second
+// copy of the byte loops in the drivers kept the compiler from inlining
+// Update into the first, 30% slower.  The copy costs the size of the
+// table every block, 32 MiB for -2, but only with -v.
+template <class Coder, int ORDER> class BitCounter<Coder, Direct<ORDER> >
+{
+    Direct<ORDER> before;
+public:
+    BitCounter(Direct<ORDER> & model) : before(model) {}
+
+    void Count(const U8 * text, U32 length)
+    {
+        for (U32 i = 0; i != length; ++i)
+        {
+            for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+            {
+                U32 p1 = Fit0(before.Predict(), PPM_P_BITS, Coder::P_BITS);
+                U32 bit = (text[i] & mask) != 0;
+                statistics->Bit(before.GetOrder(), p1, Coder::P_BITS, bit);
+                before.Update(bit);
+            }
+        }
+    }
+};
+
+#endif
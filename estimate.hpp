@@ -0,0 +1,189 @@
+// ESTIMATING THE COMPRESSED SIZE
+//
+// crook e INPUT runs the model over the input just as compression would
+// but without a coder: every decision adds what it would cost, -log2 of
+// its probability from the table in "stats.hpp", and nothing is written.
+// The blocks are typed as in "blocks.hpp", stored blocks cost their
+// length and with -b2 each block costs what the better engine needs, so
+// the sum is what crook c -i1 would write to within about 0.1%, the
+// rounding of the coder.
+//
+// With -sN only N samples of ESTIMATE_SAMPLE bytes are modelled.  The
+// file is cut into N strata of equal length and each sample starts at a
+// random point of its own stratum, the same points every time.  Every
+// sample gets a fresh model, primed with -D if given, and -j threads
+// model them at once, each with -m of memory.  The estimate is the mean
+// of their bpc with a 95% confidence interval from Student's t and the
+// spread of the samples, narrowed by the share of the file they cover.
+//
+// A fresh model hasn't seen what comes before its sample, so sampled
+// estimates err on the high side, the more so the more a model keeps
+// learning past ESTIMATE_SAMPLE bytes; the interval only accounts for
+// how the parts of the file differ.  It's meant for files too large to
+// be modelled whole, and those over 4 GiB, which the compressed format
+// can't hold, need it.
+
+#ifndef ESTIMATE_HPP
+#define ESTIMATE_HPP
+
+#include "config.hpp"
+
+#include "blocks.hpp"
+#include "phases.hpp"
+#include "progress_bar.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <unistd.h>
+#include <vector>
+
+// A coder that codes nothing, it only adds up what the code would cost.
+class CostCoder
+{
+public:
+    static const U32 P_BITS = ARI_P_BITS;
+
+    double bits;
+
+    CostCoder() : bits(0) {}
+
+    template <bool bit> void Encode(U32 p1)
+    {
+        bits += Cost(p1, P_BITS, bit);
+    }
+
+    void Normalize() {}
+
+    void FlushBuffer() {}
+};
+
+// The bytes of code of a block, like EncodeBlock.
+template <class Model>
+double EstimateCode(const U8 * text, U32 length, Model & model,
+                    RelayoutSchedule & schedule, U32 processed,
+                    U32 textLength, ProgressBar & bar)
+{
+    CostCoder rc;
+    BitCounter<CostCoder, Model> * counter = NULL;
+    if (statistics != NULL)
+        counter = new BitCounter<CostCoder, Model>(model);
+    EncodeText(text, length, rc, model, schedule, processed, textLength, bar);
+    if (counter != NULL)
+    {
+        counter->Count(text, length);
+        delete counter;
+    }
+    return rc.bits / 8;
+}
+
+template <class First, class Second>
+double EstimateCode(const U8 * text, U32 length, Either<First, Second> & model,
+                    RelayoutSchedule & schedule, U32 processed,
+                    U32 textLength, ProgressBar & bar)
+{
+    RelayoutSchedule never(-1);
+    double first = EstimateCode(text, length, *model.first, schedule,
+                                processed, textLength, bar);
+    double second = EstimateCode(text, length, *model.second, never,
+                                 processed, textLength, bar);
+    return min(first, second);
+}
+
+// The length of the code of textLength bytes of the file fd from start
+// on, coded by EncodeBlocks; false if they can't be read.
+template <class Model>
+bool EstimateBlocks(int fd, U64 start, U32 textLength, Model & model,
+                    ProgressBar & bar, double & codeLength)
+{
+    U8 * text = new U8[BLOCK_SIZE];
+    RelayoutSchedule schedule;
+    codeLength = 0;
+    bool ok = true;
+    for (U32 processed = 0; processed != textLength; )
+    {
+        U32 length = min(textLength - processed, BLOCK_SIZE);
+        {
+            PhaseTimer timer(PHASE_INPUT);
+            ssize_t n = pread(fd, text, length, start + processed);
+            if (n != (ssize_t)length)
+            {
+                if (n >= 0)
+                    errno = EIO; // the file got shorter
+                ok = false;
+                break;
+            }
+        }
+
+        if (IsNoise(text, length))
+        {
+            codeLength += 1 + length;
+            processed += length;
+            continue;
+        }
+
+        double code;
+        {
+            PhaseTimer timer(PHASE_CODING);
+            code = EstimateCode(text, length, model, schedule, processed,
+                                textLength, bar);
+        }
+        // the type byte, and the length and the coder's flush, four
+        // bytes each; trained if that's no shorter than the block
+        codeLength += 1 + min(8 + code, (double)length);
+        processed += length;
+    }
+    delete[] text;
+    return ok;
+}
+
+// Where numSamples samples of length bytes of a textLength byte file
+// start, one in every stratum; length * numSamples < textLength.
+vector<U64> SampleStarts(U64 textLength, U32 length, int numSamples)
+{
+    vector<U64> starts(numSamples);
+    U64 stratum = textLength / numSamples;
+    U64 seed = 1;
+    for (int i = 0; i != numSamples; ++i)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        U64 room = stratum > length ? stratum - length : 0;
+        starts[i] = min(i * stratum + (seed >> 11) % (room + 1),
+                        textLength - length);
+    }
+    return starts;
+}
+
+// Student's t of a two-sided 95% interval with df degrees of freedom.
+double StudentT95(int df)
+{
+    static const double t[30] =
+    {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+        2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+        2.048, 2.045, 2.042
+    };
+    return df <= 30 ? t[df - 1] : df <= 60 ? 2.000 : 1.960;
+}
+
+// The mean of the samples and the half width of its 95% interval, for
+// samples covering the share covered of the whole.
+void MeanInterval(const vector<double> & samples, double covered,
+                  double & mean, double & margin)
+{
+    int n = samples.size();
+    mean = 0;
+    for (int i = 0; i != n; ++i)
+        mean += samples[i];
+    mean /= n;
+    double squares = 0;
+    for (int i = 0; i != n; ++i)
+        squares += (samples[i] - mean) * (samples[i] - mean);
+    double sd = sqrt(squares / (n - 1));
+    margin = StudentT95(n - 1) * sd / sqrt((double)n) *
+             sqrt(max(1 - covered, 0.0));
+}
+
+#endif
@@ -8,7 +8,8 @@
 // This supports only a subset of GNU getopt's functionality.  The
 // most important of these omissions is that it cannot parse separate
 // arguments.  It does however shuffle the non-options to the end of
-// argv.
+// argv.  Long options ("--name") are looked up in a table ending with
+// a NULL name and can't take arguments.
 
 #ifndef GETOPT_HPP
 #define GETOPT_HPP
@@ -17,10 +18,17 @@
 
 #include <algorithm>
 #include <cstring>
+#include <unistd.h> // declares the two below, it has to come first
 
 char * optarg = NULL;
 int    optind = 0;
 
+struct LongOption
+{
+    const char * name;
+    int val; // returned by getopt
+};
+
 // Example of a parse:
 // cmd -ab1 x y -cd2 z -e
 //
@@ -34,7 +42,8 @@ int    optind = 0;
 //                 /       /         \/
 //           optind     end         next
 
-int getopt(int argc, char ** argv, const char * spec)
+int getopt(int argc, char ** argv, const char * spec,
+           const LongOption * longOptions = NULL)
 {
     static char * next = NULL;
     static int end = 0;
@@ -52,6 +61,20 @@ int getopt(int argc, char ** argv, const char * spec)
             return -1;
 
         next = &argv[end][1];
+
+        if (next[0] == '-' && next[1] != '\0')
+        {
+            const char * name = next + 1;
+            next = NULL;
+            optarg = NULL;
+            for (; longOptions != NULL && longOptions->name != NULL; ++longOptions)
+            {
+                if (strcmp(longOptions->name, name) == 0)
+                    return longOptions->val;
+            }
+            fprintf(stderr, "%s: invalid option '--%s'\n", argv[0], name);
+            return '?';
+        }
     }
 
     const char * opt = strchr(spec, next[0]);
@@ -0,0 +1,79 @@
+// THE BYTE KERNELS
+//
+// Every bit is coded by the same four steps of predict, code, update
+// and normalize, and every byte by eight such bits.  The kernels here
+// do one bit or one byte with a given model and coder; being templates
+// over both, every combination gets its own copy with the model's and
+// coder's state kept in registers across the steps.  The bit kernels
+// are also used to interleave several blocks, see "lanes.hpp".
+//
+// While decoding, the coder's decision and the model's update share a
+// single branch.
+//
+// Two things that look like they should help didn't (on a 4 MB text,
+// gcc 12, x86-64):
+//
+// - Unrolling the eight steps with a template over the bit mask makes
+//   both directions about 15% slower; eight inlined copies of
+//   PPM::Update don't fit the instruction cache as well as one.
+//
+// - A branchless select in the decoder (masking range and cml with
+//   the bit) is about 10% slower since the model still has to branch
+//   on the bit for Update<bit>, so the misprediction only moves.
+
+#ifndef KERNEL_HPP
+#define KERNEL_HPP
+
+#include "config.hpp"
+
+#include "stats.hpp"
+#include "utility.hpp"
+
+template <bool bit, class Coder, class Model>
+inline void EncodeBit(Coder & rc, Model & model)
+{
+    U32 p1 = Fit0(model.Predict(), PPM_P_BITS, Coder::P_BITS);
+    if (statistics != NULL)
+        statistics->Bit(model.GetOrder(), p1, Coder::P_BITS, bit);
+    rc.template Encode<bit>(p1);
+    model.template Update<bit>();
+    rc.Normalize();
+}
+
+template <class Coder, class Model>
+inline U32 DecodeBit(Coder & rc, Model & model)
+{
+    U32 p1 = Fit0(model.Predict(), PPM_P_BITS, Coder::P_BITS);
+    U32 bit = rc.Decode(p1);
+    if (statistics != NULL)
+        statistics->Bit(model.GetOrder(), p1, Coder::P_BITS, bit);
+    if (bit)
+        model.template Update<1>();
+    else
+        model.template Update<0>();
+    rc.Normalize();
+    return bit;
+}
+
+template <class Coder, class Model>
+inline void EncodeByte(Coder & rc, Model & model, U32 c)
+{
+    for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+    {
+        if (c & mask)
+            EncodeBit<1>(rc, model);
+        else
+            EncodeBit<0>(rc, model);
+    }
+}
+
+template <class Coder, class Model>
+inline U32 DecodeByte(Coder & rc, Model & model)
+{
+    U32 c = 1;
+    while (c < 0x100)
+        c = (c << 1) + DecodeBit(rc, model);
+    return c & 0xFF;
+}
+
+#endif
@@ -0,0 +1,48 @@
+// MEMORY MAPPING
+//
+// The node pools are allocated directly from the operating system
+// instead of from the heap.  Pages are only backed by memory once
+// they are touched so reserving the full -m up front costs nothing.
+// More importantly it allows a snapshot file to be mapped over the
+// front of a pool, see "snapshot.hpp".
+//
+// The mapping is private: writes go to copies of the file's pages and
+// never back to the file.
+
+#ifndef MEMORY_HPP
+#define MEMORY_HPP
+
+#include "config.hpp"
+
+#include <cstdlib>
+#include <sys/mman.h>
+
+void * AllocatePages(U64 size)
+{
+    void * p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "crook: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+void FreePages(void * p, U64 size)
+{
+    munmap(p, size);
+}
+
+// Replaces the pages at addr with the file's contents; offset must be
+// a multiple of the page size.
+bool MapFile(void * addr, U64 size, int fd, U64 offset)
+{
+    if (size == 0)
+        return true;
+    void * p = mmap(addr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED, fd, offset);
+    return p == addr;
+}
+
+#endif
@@ -0,0 +1,316 @@
+// THE MICROBENCHMARKS
+//
+// "make microbench" times the building blocks of crook one at a time,
+// in nanoseconds per operation:
+//
+// - Node::Update<0> and <1> with the count low, halfway and saturated
+// - Divide against the division it replaces, see "divide.hpp"
+// - Encoder::Encode and Decoder::Decode, each with Normalize
+// - PPM::Update, a whole bit of the model's walk
+//
+// Most come in two variants: warm, where the data fits in the L1
+// cache, and cold, where every operation goes to a random place in
+// 256 MiB and so mostly to memory.  The operations within a run don't
+// depend on each other, so the times are throughput, not latency,
+// except for the coders and the walk which are chains by nature.
+//
+// Everything is repeated and the fastest run is reported, which
+// filters out most of the noise of a busy machine.
+
+#include "config.hpp"
+
+#include "divide.hpp"
+#include "model.hpp"
+#include "rc_decoder.hpp"
+#include "rc_encoder.hpp"
+
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+const int RUNS = 5;
+
+const U32 WARM_NODES = 1 << 10;  // 16 KiB
+const U32 COLD_NODES = 1 << 24;  // 256 MiB
+
+volatile U32 sink; // keeps results from being optimized away
+
+double Now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void Report(const char * name, double seconds, U64 ops)
+{
+    printf("%-36s %8.2f ns/op\n", name, seconds * 1e9 / ops);
+    fflush(stdout);
+}
+
+// xorshift64*, as in "bench.cpp"
+class Random
+{
+    U64 x;
+public:
+    Random(U64 seed) : x(seed) {}
+
+    U32 Next()
+    {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        return (x * 2685821657736338717ull) >> 32;
+    }
+
+    U32 Below(U32 n)
+    {
+        return (U64)Next() * n >> 32;
+    }
+};
+
+// NODE::UPDATE
+
+// Every node is updated once per pass and the counts are reset between
+// passes, untimed, so they stay where they were put.
+template <bool bit>
+double TimeNodeUpdate(vector<Node> & nodes, const vector<U32> & order, U32 count)
+{
+    Node * base = &nodes[0];
+    U32 n = nodes.size();
+    double best = 1e9;
+    for (int run = 0; run != RUNS; ++run)
+    {
+        double seconds = 0;
+        for (U32 pass = 0; pass != order.size(); pass += n)
+        {
+            for (U32 i = 0; i != n; ++i)
+                nodes[i].ctr = (PPM_P_START << PPM_C_BITS) + count;
+            double start = Now();
+            for (U32 i = pass; i != pass + n; ++i)
+                base[order[i]].Update<bit>();
+            seconds += Now() - start;
+        }
+        best = min(best, seconds);
+    }
+    U32 sum = 0;
+    for (U32 i = 0; i != n; ++i)
+        sum += nodes[i].ctr;
+    sink = sum;
+    return best;
+}
+
+void BenchNodeUpdate(Random & rng)
+{
+    static const struct { const char * name; U32 count; } counts[] =
+    {
+        { "low",       PPM_C_INH },
+        { "halfway",   PPM_C_LIMIT / 2 },
+        { "saturated", PPM_C_LIMIT - 1 },
+    };
+
+    for (int cold = 0; cold != 2; ++cold)
+    {
+        U32 n = cold ? COLD_NODES : WARM_NODES;
+        vector<Node> nodes(n, Node(0, 0, 0, NULL));
+        // warm passes are repeated to make up as many operations as a
+        // cold one
+        vector<U32> order(COLD_NODES);
+        for (U32 i = 0; i != COLD_NODES; ++i)
+            order[i] = i % n;
+        if (cold)
+        {
+            for (U32 i = COLD_NODES - 1; i != 0; --i)
+                swap(order[i], order[rng.Below(i + 1)]);
+        }
+
+        for (int c = 0; c != 3; ++c)
+        {
+            char name[64];
+            snprintf(name, sizeof name, "Node::Update<0> %s, %s",
+                     counts[c].name, cold ? "cold" : "warm");
+            Report(name, TimeNodeUpdate<0>(nodes, order, counts[c].count),
+                   order.size());
+            snprintf(name, sizeof name, "Node::Update<1> %s, %s",
+                     counts[c].name, cold ? "cold" : "warm");
+            Report(name, TimeNodeUpdate<1>(nodes, order, counts[c].count),
+                   order.size());
+        }
+    }
+}
+
+// DIVIDE
+
+void BenchDivide(Random & rng)
+{
+    const U32 N = 1 << 20;
+    vector<U32> x(N), y(N);
+    for (U32 i = 0; i != N; ++i)
+    {
+        x[i] = rng.Below(PPM_P_SCALE);
+        y[i] = PPM_C_INH + rng.Below(PPM_C_LIMIT - PPM_C_INH);
+    }
+
+    double best = 1e9, bestExact = 1e9;
+    U32 worst = 0;
+    for (int run = 0; run != RUNS; ++run)
+    {
+        U32 sum = 0;
+        double start = Now();
+        for (U32 i = 0; i != N; ++i)
+            sum += Divide(x[i], PPM_P_BITS, y[i], PPM_C_BITS);
+        best = min(best, Now() - start);
+        sink = sum;
+
+        // the table holds the reciprocals of y + 2
+        sum = 0;
+        start = Now();
+        for (U32 i = 0; i != N; ++i)
+            sum += x[i] / (y[i] + 2);
+        bestExact = min(bestExact, Now() - start);
+        sink = sum;
+    }
+    for (U32 i = 0; i != N; ++i)
+    {
+        U32 a = Divide(x[i], PPM_P_BITS, y[i], PPM_C_BITS);
+        U32 b = x[i] / (y[i] + 2);
+        worst = max(worst, a > b ? a - b : b - a);
+    }
+    Report("Divide", best, N);
+    Report("x / (y + 2)", bestExact, N);
+    printf("%-36s %8u\n", "Divide, largest error", worst);
+}
+
+// THE CODERS
+
+void BenchCoders(Random & rng)
+{
+    const U32 N = 1 << 24;
+    vector<U32> p(1 << 16);
+    for (size_t i = 0; i != p.size(); ++i)
+        p[i] = 1 + rng.Below(ARI_P_SCALE - 1);
+    vector<U8> bits(N);
+    for (U32 i = 0; i != N; ++i)
+        bits[i] = rng.Below(ARI_P_SCALE) < p[i & 0xFFFF];
+
+    char * code = NULL;
+    size_t codeLength = 0;
+    double best = 1e9;
+    for (int run = 0; run != RUNS; ++run)
+    {
+        free(code);
+        FILE * stream = open_memstream(&code, &codeLength);
+        double start = Now();
+        {
+            Encoder rc(stream);
+            for (U32 i = 0; i != N; ++i)
+            {
+                if (bits[i])
+                    rc.Encode<1>(p[i & 0xFFFF]);
+                else
+                    rc.Encode<0>(p[i & 0xFFFF]);
+                rc.Normalize();
+            }
+            rc.FlushBuffer();
+        }
+        fclose(stream);
+        best = min(best, Now() - start);
+    }
+    Report("Encoder::Encode + Normalize", best, N);
+
+    best = 1e9;
+    bool ok = true;
+    for (int run = 0; run != RUNS; ++run)
+    {
+        FILE * stream = fmemopen(code, codeLength, "rb");
+        U32 wrong = 0;
+        double start = Now();
+        {
+            Decoder rc(stream);
+            rc.FillBuffer();
+            for (U32 i = 0; i != N; ++i)
+            {
+                wrong += rc.Decode(p[i & 0xFFFF]) != bits[i];
+                rc.Normalize();
+            }
+        }
+        best = min(best, Now() - start);
+        fclose(stream);
+        ok = ok && wrong == 0;
+    }
+    free(code);
+    Report(ok ? "Decoder::Decode + Normalize"
+              : "Decoder::Decode + Normalize (WRONG)", best, N);
+}
+
+// THE WALK
+
+// Text-like bytes: a few thousand "words" of lowercase letters.
+void Words(vector<U8> & text, U32 size, Random & rng)
+{
+    vector<U32> starts;
+    for (U32 i = 0; i != 4096; ++i)
+        starts.push_back(rng.Next());
+    while (text.size() < size)
+    {
+        U32 w = starts[rng.Below(rng.Below(4096) + 1)];
+        for (U32 n = 1 + w % 9; n != 0; --n, w /= 7)
+            text.push_back('a' + w % 26);
+        text.push_back(' ');
+    }
+    text.resize(size);
+}
+
+double TimeWalk(const vector<U8> & text, int memory, int order, int passes)
+{
+    PPM model(memory, order);
+    double seconds = 0;
+    for (int pass = 0; pass != passes; ++pass)
+    {
+        double start = Now();
+        U32 sum = 0;
+        for (size_t i = 0; i != text.size(); ++i)
+        {
+            for (U32 mask = 1 << 7; mask != 0; mask >>= 1)
+            {
+                sum += model.Predict();
+                if (text[i] & mask)
+                    model.Update<1>();
+                else
+                    model.Update<0>();
+            }
+        }
+        sink = sum;
+        seconds = Now() - start; // the last pass
+    }
+    return seconds;
+}
+
+void BenchWalk(Random & rng)
+{
+    // warm: 64 KiB seen once already, the model is small and repeats
+    // its steps; cold: 16 MiB into a model that grows to its limit
+    vector<U8> small, large;
+    Words(small, 1 << 16, rng);
+    Words(large, 1 << 24, rng);
+
+    double best = 1e9;
+    for (int run = 0; run != RUNS; ++run)
+        best = min(best, TimeWalk(small, 64, 4, 2));
+    Report("PPM::Update -O4, warm", best, 8 * small.size());
+
+    best = 1e9;
+    for (int run = 0; run != 2; ++run)
+        best = min(best, TimeWalk(large, 256, 6, 1));
+    Report("PPM::Update -O6 -m256, cold", best, 8 * large.size());
+}
+
+int main()
+{
+    Random rng(1);
+    BenchNodeUpdate(rng);
+    BenchDivide(rng);
+    BenchCoders(rng);
+    BenchWalk(rng);
+    return 0;
+}
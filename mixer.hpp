@@ -0,0 +1,219 @@
+// THE MIXER
+//
+// With the option -oN two models are run side by side: the usual one
+// with the order limit given by -O and a second one limited to N
+// bytes of context.  The memory limit is split evenly between them.
+// A low order model learns quickly while a high order model captures
+// long range structure, so neither one is best everywhere.
+//
+// Their predictions are combined by logistic mixing as in PAQ: each
+// probability is mapped to the logistic domain
+//
+// > stretch(p) = ln(p/(1-p)),
+//
+// a weighted sum of the stretched probabilities is computed and then
+// mapped back with the inverse function squash.  After each bit the
+// weights are adjusted to reduce the coding cost, i.e. by gradient
+// descent on -log2(p):
+//
+// > w[i] += rate * stretch(p[i]) * (bit - p).
+//
+// Weights are selected by the order of the model given by -O, so the
+// mixer can learn that a model deep in a long context is more
+// trustworthy than one that has just fallen back to order 0.
+//
+// Stretched probabilities are in the range -2047..2047 with 8
+// fractional bits, weights have 16 fractional bits.  The mixer works
+// with ARI_P_BITS probabilities so it gains nothing from the 16-bit
+// coder (-e2).
+
+#ifndef MIXER_HPP
+#define MIXER_HPP
+
+#include "config.hpp"
+
+#include "model.hpp"
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+class StretchTable
+{
+    short t[ARI_P_SCALE];
+public:
+    StretchTable()
+    {
+        for (U32 p = 0; p < ARI_P_SCALE; ++p)
+        {
+            double x = (p + 0.5) / ARI_P_SCALE;
+            double s = log(x / (1 - x)) * MIX_S_SCALE;
+            t[p] = max(-MIX_S_LIMIT, min(MIX_S_LIMIT, (int)floor(s + 0.5)));
+        }
+    }
+    int operator[](U32 p)
+    {
+        assert(p < ARI_P_SCALE);
+        return t[p];
+    }
+} stretch;
+
+class SquashTable
+{
+    U16 t[2 * MIX_S_LIMIT + 1];
+public:
+    SquashTable()
+    {
+        for (int s = -MIX_S_LIMIT; s <= MIX_S_LIMIT; ++s)
+        {
+            double p = ARI_P_SCALE / (1 + exp(-(double)s / MIX_S_SCALE));
+            t[s + MIX_S_LIMIT] = max(1, min((int)ARI_P_SCALE - 1,
+                                            (int)floor(p + 0.5)));
+        }
+    }
+    U32 operator[](int s)
+    {
+        s = max(-MIX_S_LIMIT, min(MIX_S_LIMIT, s));
+        return t[s + MIX_S_LIMIT];
+    }
+} squash;
+
+class Mixer
+{
+    static const int numSets = MIX_W_SETS;
+    int w[numSets][2];
+    int * set;
+    int s0, s1;
+    U32 p1;
+
+    static int Clamp(int x)
+    {
+        return max(-MIX_W_LIMIT, min(MIX_W_LIMIT, x));
+    }
+public:
+    Mixer()
+    {
+        for (int i = 0; i != numSets; ++i)
+            w[i][0] = w[i][1] = MIX_W_SCALE / 2;
+        set = w[0];
+        s0 = s1 = 0;
+        p1 = ARI_P_SCALE / 2;
+    }
+
+    // Mixes two PPM_P_BITS probabilities into an ARI_P_BITS one.
+    U32 Mix(U32 p0In, U32 p1In, int ctx)
+    {
+        set = w[min(ctx, numSets - 1)];
+        s0 = stretch[Fit(p0In, PPM_P_BITS, ARI_P_BITS)];
+        s1 = stretch[Fit(p1In, PPM_P_BITS, ARI_P_BITS)];
+        p1 = squash[(s0 * set[0] + s1 * set[1]) >> MIX_W_BITS];
+        return p1;
+    }
+
+    template <bool bit> void Update()
+    {
+        int err = ((int)bit << ARI_P_BITS) - (int)p1;
+        set[0] = Clamp(set[0] + ((s0 * err) >> MIX_W_RATE));
+        set[1] = Clamp(set[1] + ((s1 * err) >> MIX_W_RATE));
+    }
+
+    void Save(Snapshot & snapshot)
+    {
+        for (int i = 0; i != numSets; ++i)
+        {
+            snapshot.PutU32(w[i][0]);
+            snapshot.PutU32(w[i][1]);
+        }
+    }
+
+    void Load(Snapshot & snapshot)
+    {
+        for (int i = 0; i != numSets; ++i)
+        {
+            w[i][0] = snapshot.GetU32();
+            w[i][1] = snapshot.GetU32();
+        }
+    }
+};
+
+class Ensemble
+{
+    PPM first;
+    PPM second;
+    Mixer mixer;
+public:
+    Ensemble(int memoryLimit, int firstOrderLimit, int secondOrderLimit,
+             int allocator = ALLOC_BUMP, int minVisits = 0)
+        : first (max(1, memoryLimit - memoryLimit / 2), firstOrderLimit,
+                 allocator, minVisits),
+          second(max(1,              memoryLimit / 2), secondOrderLimit,
+                 allocator, minVisits) {}
+
+    U32 Predict()
+    {
+        U32 p1 = mixer.Mix(first.Predict(), second.Predict(),
+                           first.GetOrder() / 8);
+        return Fit(p1, ARI_P_BITS, PPM_P_BITS);
+    }
+
+    template <bool bit> void Update()
+    {
+        mixer.Update<bit>();
+        first.Update<bit>();
+        second.Update<bit>();
+    }
+
+    template <bool bit> void UpdateFrozen()
+    {
+        mixer.Update<bit>();
+        first.UpdateFrozen<bit>();
+        second.UpdateFrozen<bit>();
+    }
+
+    int GetOrder()
+    {
+        return first.GetOrder();
+    }
+
+    U32 GetUsedMemory()
+    {
+        return first.GetUsedMemory() + second.GetUsedMemory();
+    }
+
+    U64 GetUsedBytes()
+    {
+        return first.GetUsedBytes() + second.GetUsedBytes();
+    }
+
+    U32 GetMemoryLimit()
+    {
+        return first.GetMemoryLimit() + second.GetMemoryLimit();
+    }
+
+    // The second model is smaller and usually fills up first.
+    bool IsFull()
+    {
+        return first.IsFull() && second.IsFull();
+    }
+
+    void Relayout()
+    {
+        first.Relayout();
+        second.Relayout();
+    }
+
+    void Save(Snapshot & snapshot)
+    {
+        mixer.Save(snapshot);
+        first.Save(snapshot);
+        second.Save(snapshot);
+    }
+
+    bool Load(Snapshot & snapshot)
+    {
+        mixer.Load(snapshot);
+        return first.Load(snapshot) && second.Load(snapshot);
+    }
+};
+
+#endif
@@ -0,0 +1,130 @@
+// HARDWARE PERFORMANCE COUNTERS
+//
+// With --perf each file's compression or decompression is counted by
+// the processor's performance counters, opened with perf_event_open,
+// and the counts are printed per input byte once it's done:
+//
+// - cycles and instructions, and their ratio
+// - L1 data cache read misses
+// - last level cache read misses
+// - data TLB read misses
+//
+// Only the thread doing the work is counted and only in user space,
+// which needs no privileges as long as
+// /proc/sys/kernel/perf_event_paranoid is 2 or less.  Counters the
+// kernel or the processor can't provide, as in most virtual machines,
+// are reported as n/a.  When there are more counters than the processor
+// has registers the kernel takes turns and the counts are scaled up
+// from the time each one ran.
+//
+// Counting through the kernel's counters is what the perf tool does
+// too; this way it works per file, also with -j.
+
+#ifndef PERF_HPP
+#define PERF_HPP
+
+#include "config.hpp"
+
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+class PerfCounters
+{
+    static const int NUM_COUNTERS = 5;
+
+    int fd[NUM_COUNTERS];
+    double counts[NUM_COUNTERS];
+
+    static int Open(U32 type, U64 config)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // this thread on any processor
+        return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    static U64 Cache(U64 cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+public:
+    PerfCounters()
+    {
+        fd[0] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        fd[1] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fd[2] = Open(PERF_TYPE_HW_CACHE, Cache(PERF_COUNT_HW_CACHE_L1D));
+        fd[3] = Open(PERF_TYPE_HW_CACHE, Cache(PERF_COUNT_HW_CACHE_LL));
+        fd[4] = Open(PERF_TYPE_HW_CACHE, Cache(PERF_COUNT_HW_CACHE_DTLB));
+        for (int i = 0; i != NUM_COUNTERS; ++i)
+            counts[i] = -1;
+    }
+
+    ~PerfCounters()
+    {
+        for (int i = 0; i != NUM_COUNTERS; ++i)
+        {
+            if (fd[i] >= 0)
+                close(fd[i]);
+        }
+    }
+
+    void Start()
+    {
+        for (int i = 0; i != NUM_COUNTERS; ++i)
+        {
+            if (fd[i] >= 0)
+            {
+                ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    void Stop()
+    {
+        for (int i = 0; i != NUM_COUNTERS; ++i)
+        {
+            if (fd[i] < 0)
+                continue;
+            ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            U64 value[3]; // count, time enabled, time running
+            if (read(fd[i], value, sizeof value) != sizeof value ||
+                value[2] == 0)
+                continue;
+            counts[i] = (double)value[0] * value[1] / value[2];
+        }
+    }
+
+    void Print(const char * name, U64 bytes)
+    {
+        static const char * const names[NUM_COUNTERS] =
+        {
+            "cycles", "instructions", "L1d misses", "LLC misses", "dTLB misses"
+        };
+        double per = 1.0 / (bytes != 0 ? bytes : 1);
+        fprintf(stderr, "%s: performance counters per input byte\n", name);
+        for (int i = 0; i != NUM_COUNTERS; ++i)
+        {
+            if (counts[i] < 0)
+                fprintf(stderr, "  %-13s %10s\n", names[i], "n/a");
+            else
+                fprintf(stderr, "  %-13s %10.3f\n", names[i], counts[i] * per);
+        }
+        if (counts[0] > 0 && counts[1] >= 0)
+            fprintf(stderr, "  %-13s %10.3f\n", "per cycle", counts[1] / counts[0]);
+    }
+};
+
+#endif
@@ -0,0 +1,260 @@
+// WHERE THE TIME GOES
+//
+// With --phases each file's time is split between
+//
+// - input:  reading the text or the code
+// - model:  predicting and updating the model
+// - coder:  the range coder, encoding or decoding and normalizing
+// - output: writing the code or the text
+// - other:  the rest, e.g. the progress bar, the entropy test of each
+//           block and copying the code around in memory
+//
+// and the shares are printed once it's done.  I/O is timed around each
+// read and write, which happen a block or a buffer at a time, so the
+// clock costs nothing there.  The model and the coder take turns for
+// every bit, though, and reading the clock twice a bit would take about
+// as long as the coding itself, so only every PHASES_SAMPLE-th byte is
+// timed in detail, through a coder that times its own calls.  The time
+// of all the coding is split between the two as it was in those bytes.
+// The model's share includes the kernels' own work and the progress
+// bar; relayouts and training on stored blocks are timed as they
+// happen.  With -i the lanes are coded in lock-step and aren't
+// sampled, and neither are the bytes of a cost map (see "costmap.hpp"),
+// so the model and the coder are shown together.
+//
+// The clock is the processor's time stamp counter, which the kernel
+// keeps in step across cores on anything recent, and the cost of
+// reading it is subtracted from every sample.  It ticks in wall-clock
+// time, so waiting for the disk shows up as input or output and not as
+// nothing.
+//
+// As in "stats.hpp", the counters are reached through a thread-local
+// pointer that's NULL without --phases.
+
+#ifndef PHASES_HPP
+#define PHASES_HPP
+
+#include "config.hpp"
+
+#include "kernel.hpp"
+#include "progress_bar.hpp"
+
+#include <algorithm>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+inline U64 Ticks()
+{
+#ifdef __x86_64__
+    // without the fence the counter may be read before the loads ahead
+    // of it are done, which charges a cache miss of the model to the
+    // coder that waits for its prediction
+    _mm_lfence();
+    return __rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+// Phases are timed exclusively: a timer started within another one
+// stops the outer one's clock until it's done.
+const int PHASE_OTHER  = 0;
+const int PHASE_INPUT  = 1;
+const int PHASE_OUTPUT = 2;
+const int PHASE_MODEL  = 3; // the model alone
+const int PHASE_CODING = 4; // the kernels, split by the samples
+const int NUM_PHASES   = 5;
+
+struct Phases
+{
+    U64 ticks[NUM_PHASES];
+    int current;           // the phase being timed
+    U64 since;             // when it started
+    U64 bytes;             // bytes coded
+    U64 sampledBytes;
+    U64 sampledModel, sampledCoder; // ticks of the sampled bytes
+    U32 countdown;         // bytes to the next sample
+    U32 seed;              // of the gaps between samples
+    U64 overhead;          // ticks of reading the clock
+    double startTime, stopTime;
+
+    Phases() : current(PHASE_OTHER), since(0), bytes(0), sampledBytes(0),
+               sampledModel(0), sampledCoder(0), countdown(PHASES_SAMPLE),
+               seed(1), startTime(0), stopTime(0)
+    {
+        fill(ticks, ticks + NUM_PHASES, 0);
+
+        // the cheapest of many back-to-back reads
+        overhead = ~0ull;
+        for (int i = 0; i != 1000; ++i)
+        {
+            U64 t = Ticks();
+            overhead = min(overhead, Ticks() - t);
+        }
+    }
+
+    void Start()
+    {
+        startTime = WallClock();
+        current = PHASE_OTHER;
+        since = Ticks();
+    }
+
+    void Stop()
+    {
+        Enter(PHASE_OTHER);
+        stopTime = WallClock();
+    }
+
+    // Switches to another phase and returns the one before.
+    int Enter(int phase)
+    {
+        U64 now = Ticks();
+        ticks[current] += now - since;
+        since = now;
+        swap(current, phase);
+        return phase;
+    }
+
+    // Called for every byte coded; true if it's to be timed.
+    bool Sample()
+    {
+        ++bytes;
+        if (--countdown != 0)
+            return false;
+        // random gaps, PHASES_SAMPLE on average; with a fixed one every
+        // sample would fall on the same byte of a period of the coder,
+        // like the rANS coder's blocks, and either all or none of them
+        // on its flushes
+        seed = seed * 1103515245 + 12345;
+        countdown = 1 + (seed >> 8) % (2 * PHASES_SAMPLE - 1);
+        return true;
+    }
+
+    // A sampled byte took total ticks, coder of them in calls to the
+    // coder; each call read the clock twice.
+    void Sampled(U64 total, U64 coder, U32 calls)
+    {
+        U64 clock = overhead * calls;
+        U64 rest = coder + clock + overhead; // the byte's own reads too
+        ++sampledBytes;
+        sampledModel += total > rest ? total - rest : 0;
+        sampledCoder += coder > clock ? coder - clock : 0;
+    }
+
+    void Print(const char * name)
+    {
+        U64 total = 0;
+        for (int i = 0; i != NUM_PHASES; ++i)
+            total += ticks[i];
+        double perTick = (stopTime - startTime) / max(total, (U64)1);
+        double percent = 100.0 / max(total, (U64)1);
+
+        fprintf(stderr, "%s: time by phase\n", name);
+        const char * format = "  %-7s %8.3f s %5.1f%%\n";
+        fprintf(stderr, format, "input", ticks[PHASE_INPUT] * perTick,
+                ticks[PHASE_INPUT] * percent);
+        if (sampledModel + sampledCoder != 0)
+        {
+            double share = (double)sampledModel / (sampledModel + sampledCoder);
+            double model = ticks[PHASE_MODEL] + ticks[PHASE_CODING] * share;
+            double coder = ticks[PHASE_CODING] * (1 - share);
+            fprintf(stderr, format, "model", model * perTick, model * percent);
+            fprintf(stderr, format, "coder", coder * perTick, coder * percent);
+        }
+        else
+        {
+            // nothing sampled, with -i or -w
+            double coding = ticks[PHASE_MODEL] + ticks[PHASE_CODING];
+            fprintf(stderr, "  %-15s %8.3f s %5.1f%%\n", "model and coder",
+                    coding * perTick, coding * percent);
+        }
+        fprintf(stderr, format, "output", ticks[PHASE_OUTPUT] * perTick,
+                ticks[PHASE_OUTPUT] * percent);
+        fprintf(stderr, format, "other", ticks[PHASE_OTHER] * perTick,
+                ticks[PHASE_OTHER] * percent);
+        fprintf(stderr, "  %llu of %llu bytes sampled\n",
+                (unsigned long long)sampledBytes, (unsigned long long)bytes);
+    }
+};
+
+__thread Phases * phases = NULL; // this thread's, or NULL
+
+// Times its scope as the given phase, if phases are being timed.
+class PhaseTimer
+{
+    int previous;
+public:
+    PhaseTimer(int phase)
+        : previous(phases != NULL ? phases->Enter(phase) : 0) {}
+
+    ~PhaseTimer()
+    {
+        if (phases != NULL)
+            phases->Enter(previous);
+    }
+};
+
+// A coder that times the calls to another one.
+template <class Coder> class TimedCoder
+{
+    Coder & rc;
+public:
+    static const U32 P_BITS = Coder::P_BITS;
+
+    U64 ticks;
+    U32 calls;
+
+    TimedCoder(Coder & rc) : rc(rc), ticks(0), calls(0) {}
+
+    template <bool bit> void Encode(U32 p1)
+    {
+        U64 start = Ticks();
+        rc.template Encode<bit>(p1);
+        ticks += Ticks() - start;
+        ++calls;
+    }
+
+    U32 Decode(U32 p1)
+    {
+        U64 start = Ticks();
+        U32 bit = rc.Decode(p1);
+        ticks += Ticks() - start;
+        ++calls;
+        return bit;
+    }
+
+    void Normalize()
+    {
+        U64 start = Ticks();
+        rc.Normalize();
+        ticks += Ticks() - start;
+        ++calls;
+    }
+};
+
+// Codes a sampled byte with the usual kernels, see "kernel.hpp", timing
+// the coder apart from the rest.
+template <class Coder, class Model>
+void EncodeByteTimed(Coder & rc, Model & model, U32 c)
+{
+    TimedCoder<Coder> timed(rc);
+    U64 start = Ticks();
+    EncodeByte(timed, model, c);
+    phases->Sampled(Ticks() - start, timed.ticks, timed.calls);
+}
+
+template <class Coder, class Model>
+U32 DecodeByteTimed(Coder & rc, Model & model)
+{
+    TimedCoder<Coder> timed(rc);
+    U64 start = Ticks();
+    U32 c = DecodeByte(timed, model);
+    phases->Sampled(Ticks() - start, timed.ticks, timed.calls);
+    return c;
+}
+
+#endif
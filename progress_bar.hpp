@@ -5,6 +5,30 @@
 // doing of a task that has not yet been done.
 //
 // In this case, data compression.
+//
+// The bar goes to stderr, and only if that's a terminal and -q wasn't
+// given.  It's redrawn at most every PROGRESS_INTERVAL seconds; the
+// clock is only read every PROGRESS_CHECK bytes.  Speeds and times are
+// wall-clock time, so waiting for I/O or for other threads counts.  The
+// memory is shown against what the models may take in all, which is
+// -m once per lane and per engine with -b2, see SetMemoryLimit.
+//
+// In batch mode several files are worked on at once so there is no
+// bar, just a line with the file name once each one is finished.  The
+// summary lines go to stdout unless -q was given.
+//
+// With -J FD the same progress is also written to the file descriptor
+// FD as JSON lines, one object per update and a final one with "done"
+// set, e.g.
+//
+// > {"file":"in.txt","command":"c","processed":1048576,"total":4000000,
+// >  "elapsed":0.210,"bytes_per_second":4993219,"eta":0.591,
+// >  "memory_mib":12,"done":false}
+//
+// (all on one line).  The final object adds the "output" length.  Each
+// line is written with a single write() so the workers of -j don't mix
+// their lines up on a pipe.  Each bar stops reporting on its own once
+// a write fails, so the workers don't share any state.
 
 #ifndef PROGRESS_BAR_HPP
 #define PROGRESS_BAR_HPP
@@ -13,56 +37,182 @@
 
 #include <algorithm>
 #include <ctime>
+#include <string>
+#include <unistd.h>
+
+double WallClock()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
 
 class ProgressBar
 {
-    static const int period = 1 << 18;
-    clock_t start;
-    void Display(U32 processed, U32 total, U32 memory)
+    const char * name;
+    bool batch;
+    bool visible; // the bar is drawn
+    bool silent;  // nothing is shown or reported at all
+    int fd;       // -J, or -1 once the reader is gone
+    U32 limit;    // the memory all the models may take, in MiB
+    double start;
+    double last;  // time of the last update
+    U32 next;     // bytes processed at which to look at the clock again
+
+    void Display(U32 processed, U32 total, U32 memory, double now)
     {
-        int percentage = (processed + total/100/2) / (total/100);
-        printf("\r%3d%% ", percentage);
+        // empty and tiny files count as done from the start
+        if (total < 100)
+            processed = total = 100;
+
+        int percentage = ((U64)processed * 100 + total/2) / total;
+        fprintf(stderr, "\r%3d%% ", percentage);
 
         const char blocks[] = "[########################################]";
         const char spaces[] = "[                                        ]";
         int maxBlocks = 40;
-        int numBlocks = (processed + total/maxBlocks/2) / (total/maxBlocks);
+        int numBlocks = ((U64)processed * maxBlocks + total/2) / total;
         int fromBlocks = numBlocks + 1;
         int fromSpaces = maxBlocks + 1 - numBlocks;
-        fwrite(blocks             , fromBlocks, 1, stdout);
-        fwrite(spaces + fromBlocks, fromSpaces, 1, stdout);
+        fwrite(blocks             , fromBlocks, 1, stderr);
+        fwrite(spaces + fromBlocks, fromSpaces, 1, stderr);
 
-        clock_t current = clock();
-        int speed = processed / 1024 * CLOCKS_PER_SEC / (current - start + 1);
-        printf("%6d kiB/s %d/%d MiB", speed, memory, memoryLimit);
+        int speed = processed / 1024 / max(now - start, 1e-3);
+        fprintf(stderr, "%6d kiB/s %d/%d MiB", speed, memory, limit);
 
-        fflush(stdout);
+        fflush(stderr);
+    }
+
+    void Report(U64 processed, U64 total, U32 memory, double now,
+                bool done, U64 output)
+    {
+        if (fd < 0 || silent)
+            return;
+        double elapsed = now - start;
+        double speed = processed / max(elapsed, 1e-6);
+        double eta = processed != 0 ? (total - processed) / speed : -1;
+
+        // quotes and backslashes are the only characters of a file
+        // name that need escaping, short of control characters
+        string file;
+        for (const char * p = name; *p != '\0'; ++p)
+        {
+            if (*p == '"' || *p == '\\')
+                file += '\\';
+            if ((U8)*p >= 0x20)
+                file += *p;
+        }
+
+        char line[1024];
+        int n = snprintf(line, sizeof line,
+                         "{\"file\":\"%s\",\"command\":\"%c\",\"processed\":%llu,"
+                         "\"total\":%llu,\"elapsed\":%.3f,\"bytes_per_second\":%.0f,"
+                         "\"eta\":%.3f,\"memory_mib\":%u,\"done\":%s",
+                         file.c_str(), command, (unsigned long long)processed,
+                         (unsigned long long)total, elapsed,
+                         speed, eta, memory, done ? "true" : "false");
+        if (done && n < (int)sizeof line)
+            n += snprintf(line + n, sizeof line - n, ",\"output\":%llu",
+                          (unsigned long long)output);
+        if (n < (int)sizeof line - 2)
+        {
+            line[n++] = '}';
+            line[n++] = '\n';
+            if (write(fd, line, n) != n)
+                fd = -1; // the reader is gone, stop telling it
+        }
     }
 public:
-    ProgressBar()
+    // The name is used in the batch mode summaries and the JSON lines.
+    // A silent bar is for work that's part of a file, like the samples
+    // of "estimate.hpp".
+    ProgressBar(const char * name, bool batch = false, bool silent = false)
+        : name(name),
+          batch(batch),
+          visible(!batch && !silent && !quiet && isatty(2)),
+          silent(silent),
+          fd(progressFd),
+          limit(memoryLimit),
+          start(WallClock()),
+          last(start),
+          next(0) {}
+
+    // Once the models are made, see GetMemoryLimit in "lanes.hpp".
+    void SetMemoryLimit(U32 memory)
     {
-        start = clock();
+        limit = memory;
     }
 
     void Update(U32 processed, U32 total, U32 memory)
     {
-        if (processed % period == 0)
-            Display(processed, total, memory);
+        if (processed < next)
+            return;
+        next = processed + PROGRESS_CHECK;
+        if (!visible && (fd < 0 || silent))
+            return;
+
+        double now = WallClock();
+        if (now - last < PROGRESS_INTERVAL && processed != 0)
+            return;
+        last = now;
+        if (visible)
+            Display(processed, total, memory, now);
+        Report(processed, total, memory, now, false, 0);
     }
 
     void Finish(U32 textLength, U32 codeLength, U32 memory)
     {
-        Display(textLength, textLength, memory);
+        double now = WallClock();
+        if (visible)
+        {
+            Display(textLength, textLength, memory, now);
+            fprintf(stderr, "\n");
+        }
+        Report(textLength, textLength, memory, now, true,
+               command == 'd' ? textLength : codeLength);
 
-        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        double seconds = now - start;
         double bpc = 8.0 * codeLength / textLength;
 
         if (command == 'd')
             swap(textLength, codeLength);
 
-        putc('\n', stdout);
-        printf("%d -> %d, %.2f s, %.3f bpc.\n",
-               textLength, codeLength, seconds, bpc);
+        if (quiet)
+            return;
+        if (!batch)
+            printf("%d -> %d, %.2f s, %.3f bpc.\n",
+                   textLength, codeLength, seconds, bpc);
+        else
+            printf("%s: %d -> %d, %.2f s, %.3f bpc.\n",
+                   name, textLength, codeLength, seconds, bpc);
+        fflush(stdout);
+    }
+
+    // The summary of crook e: codeLength is an estimate, or the mean of
+    // numSamples samples give or take margin bits per byte.
+    void Estimated(U64 textLength, double codeLength, double margin,
+                   int numSamples, U32 memory)
+    {
+        double now = WallClock();
+        if (visible)
+        {
+            Display(100, 100, memory, now);
+            fprintf(stderr, "\n");
+        }
+        Report(textLength, textLength, memory, now, true, codeLength + 0.5);
+
+        if (quiet)
+            return;
+        double seconds = now - start;
+        double bpc = 8 * codeLength / textLength;
+        if (batch)
+            printf("%s: ", name);
+        printf("%llu -> ~%.0f, %.2f s, %.3f bpc", (unsigned long long)textLength,
+               codeLength, seconds, bpc);
+        if (numSamples != 0)
+            printf(" ± %.3f from %d samples", margin, numSamples);
+        printf(".\n");
+        fflush(stdout);
     }
 };
 
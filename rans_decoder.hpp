@@ -0,0 +1,90 @@
+// THE rANS DECODER
+//
+// See also: the encoder in "rans_encoder.hpp".
+
+#ifndef RANS_DECODER_HPP
+#define RANS_DECODER_HPP
+
+#include "config.hpp"
+
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+class RansDecoder
+{
+    FILE * codeFile;
+    U8 * code;
+    U8 * ptr;
+    U32 x[RANS_STREAMS];
+    U32 * cur;  // the state that decoded the last bit
+    U32 count;
+public:
+    static const U32 P_BITS = ARI_P_BITS;
+
+    RansDecoder(FILE * codeFile)
+        : codeFile(codeFile),
+          code(new U8[RANS_CODE_LIMIT]()),
+          ptr(code),
+          x(),
+          cur(x),
+          count(RANS_BLOCK_SIZE) {}
+
+    ~RansDecoder()
+    {
+        delete[] code;
+    }
+
+    // Blocks are read when their first bit is decoded so that nothing
+    // is read past the end of the last one.
+    void FillBuffer() {}
+
+    bool Decode(U32 p1)
+    {
+        assert(0 < p1 && p1 < ARI_P_SCALE);
+        if (count == RANS_BLOCK_SIZE)
+            ReadBlock();
+
+        cur = &x[count++ % RANS_STREAMS];
+        U32 & xj = *cur;
+        U32 r = xj & (ARI_P_SCALE - 1);
+        if (r < p1)
+        {
+            xj = p1 * (xj >> ARI_P_BITS) + r;
+            return 1;
+        }
+        else
+        {
+            xj = (ARI_P_SCALE - p1) * (xj >> ARI_P_BITS) + r - p1;
+            return 0;
+        }
+    }
+
+    void Normalize()
+    {
+        while (*cur < RANS_L)
+            *cur = (*cur << 8) + *ptr++;
+    }
+
+private:
+    void ReadBlock()
+    {
+        // a corrupted block decodes as garbage but stays in the buffer;
+        // a truncated one decodes from zeros, as a new block so that
+        // ptr can't run past the buffer
+        U32 length = min(GetU32(codeFile), RANS_CODE_LIMIT);
+        if (fread(code, 1, length, codeFile) != length)
+            memset(code, 0, RANS_CODE_LIMIT);
+
+        ptr = code;
+        for (U32 j = 0; j != RANS_STREAMS; ++j, ptr += 4)
+        {
+            x[j] = ((U32)ptr[0] << 24) + (ptr[1] << 16) + (ptr[2] << 8) + ptr[3];
+            x[j] = max(x[j], RANS_L); // or Normalize could loop forever
+        }
+        count = 0;
+    }
+};
+
+#endif
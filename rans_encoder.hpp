@@ -0,0 +1,157 @@
+// THE rANS ENCODER
+//
+// An alternative to the arithmetic coder, selected with -e1.  This is
+// a binary version of Duda's range variant of asymmetric numeral
+// systems (rANS) as popularized by Fabian Giesen.  Coding the bit b
+// with probability p(b) = f/SCALE (with cumulative frequency s) maps
+// the state x to
+//
+// > x' = (x / f) * SCALE + x % f + s
+//
+// and the decoder undoes it with
+//
+// > x = f * (x' / SCALE) + x' % SCALE - s.
+//
+// rANS works as a stack: the decoder pops bits in the reverse order
+// that the encoder pushed them.  So the encoder only buffers the bits
+// and their probabilities until a block of RANS_BLOCK_SIZE bits is
+// full, and then codes the block backwards into a buffer that is
+// filled from the end.
+//
+// There are RANS_STREAMS independent states which take turns: bit i
+// of a block is coded with state i % RANS_STREAMS.  Since consecutive
+// bits don't depend on each other's states the CPU can overlap their
+// arithmetic and renormalization.  All states share one byte stream;
+// that works as long as the decoder consumes everything in exactly
+// the reverse order.
+//
+// Each state x is kept in [RANS_L, RANS_L * 256) and renormalized
+// one byte at a time.  Every block is written as its length in bytes
+// followed by the final states and the renormalization bytes.
+//
+// As in "divide.hpp" the division by f is replaced by multiplication
+// with a reciprocal looked up from a table, here with enough
+// precision to be exact for all states below 2^31:
+//
+// > x / f = (x * rcp[f] >> 32) >> shift[f].
+//
+// For f = 1 the reciprocal is 2^32-1 which gives x-1 instead of x;
+// the missing f is made up for by a bias of SCALE-1.
+//
+// See also: the decoder in "rans_decoder.hpp".
+
+#ifndef RANS_ENCODER_HPP
+#define RANS_ENCODER_HPP
+
+#include "config.hpp"
+
+#include "utility.hpp"
+
+class RansReciprocalTable
+{
+    U32 rcp[ARI_P_SCALE];
+    U8  shift[ARI_P_SCALE];
+public:
+    RansReciprocalTable()
+    {
+        rcp[1] = 0xFFFFFFFF;
+        shift[1] = 0;
+        for (U32 f = 2; f < ARI_P_SCALE; ++f)
+        {
+            U32 s = 0;
+            while (f > (1u << s))
+                ++s;
+            rcp[f] = ((1ull << (s + 31)) + f - 1) / f;
+            shift[f] = s - 1;
+        }
+    }
+
+    // Codes a bit with frequency f and cumulative frequency s.
+    U32 Encode(U32 x, U32 f, U32 s)
+    {
+        assert(0 < f && f < ARI_P_SCALE);
+        U32 q = ((U64)x * rcp[f] >> 32) >> shift[f];
+        U32 bias = (f == 1) ? ARI_P_SCALE - 1 : 0;
+        return x + s + bias + q * (ARI_P_SCALE - f);
+    }
+} ransReciprocals;
+
+class RansEncoder
+{
+    FILE * codeFile;
+    U16 * bits; // (bit << 15) + p1 for each bit in the block
+    U8  * code;
+    U32 count;
+public:
+    static const U32 P_BITS = ARI_P_BITS;
+
+    RansEncoder(FILE * codeFile)
+        : codeFile(codeFile),
+          bits(new U16[RANS_BLOCK_SIZE]),
+          code(new U8[RANS_CODE_LIMIT]),
+          count(0) {}
+
+    ~RansEncoder()
+    {
+        delete[] bits;
+        delete[] code;
+    }
+
+    template <bool bit> void Encode(U32 p1)
+    {
+        assert(0 < p1 && p1 < ARI_P_SCALE);
+        bits[count++] = (bit << 15) + p1;
+    }
+
+    void Normalize()
+    {
+        if (count == RANS_BLOCK_SIZE)
+            FlushBlock();
+    }
+
+    void FlushBuffer()
+    {
+        if (count != 0)
+            FlushBlock();
+    }
+
+private:
+    void FlushBlock()
+    {
+        U32 x[RANS_STREAMS];
+        for (U32 j = 0; j != RANS_STREAMS; ++j)
+            x[j] = RANS_L;
+
+        U8 * ptr = code + RANS_CODE_LIMIT;
+        for (U32 i = count; i-- != 0; )
+        {
+            U32 & xj = x[i % RANS_STREAMS];
+            U32 p1 = bits[i] & 0x7FFF;
+            U32 f = (bits[i] >> 15) ? p1 : ARI_P_SCALE - p1;
+            U32 s = (bits[i] >> 15) ?  0 : p1;
+
+            U32 xMax = ((RANS_L >> ARI_P_BITS) << 8) * f;
+            while (xj >= xMax)
+            {
+                *--ptr = xj;
+                xj >>= 8;
+            }
+            xj = ransReciprocals.Encode(xj, f, s);
+        }
+
+        for (U32 j = RANS_STREAMS; j-- != 0; )
+        {
+            *--ptr = x[j] >>  0;
+            *--ptr = x[j] >>  8;
+            *--ptr = x[j] >> 16;
+            *--ptr = x[j] >> 24;
+        }
+
+        U32 length = code + RANS_CODE_LIMIT - ptr;
+        PutU32(length, codeFile);
+        fwrite(ptr, 1, length, codeFile);
+        count = 0;
+    }
+};
+
+#endif
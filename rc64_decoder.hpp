@@ -0,0 +1,56 @@
+// THE 64-BIT ARITHMETIC DECODER
+//
+// See also: the encoder in "rc64_encoder.hpp".
+
+#ifndef RC64_DECODER_HPP
+#define RC64_DECODER_HPP
+
+#include "config.hpp"
+
+#include "utility.hpp"
+
+class Decoder64
+{
+    FILE * codeFile;
+    U64 range;
+    U64 cml; // code minus low
+public:
+    static const U32 P_BITS = ARI64_P_BITS;
+
+    Decoder64(FILE * codeFile)
+        : codeFile(codeFile),
+          range(~(U64)0),
+          cml(0) {}
+
+    void FillBuffer()
+    {
+        for (int i = 0; i < 3; ++i)
+            cml = (cml << 32) + GetU32(codeFile);
+    }
+
+    bool Decode(U32 p1)
+    {
+        assert(0 < p1 && p1 < ARI64_P_SCALE);
+        U64 mid = (range >> ARI64_P_BITS) * p1;
+        if (cml < mid)
+        {
+            range = mid;
+            return 1;
+        }
+        else
+        {
+            cml -= mid, range -= mid;
+            return 0;
+        }
+    }
+
+    void Normalize()
+    {
+        if (range <= 0xFFFFFFFF)
+        {
+            cml = (cml << 32) + GetU32(codeFile);
+            range <<= 32;
+        }
+    }
+};
+#endif
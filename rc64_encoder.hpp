@@ -0,0 +1,90 @@
+// THE 64-BIT ARITHMETIC ENCODER
+//
+// A variant of the arithmetic coder in "rc_encoder.hpp", selected
+// with -e2, with 64-bit low and range registers which are
+// renormalized 32 bits at a time.  The range never drops below 2^32
+// so probabilities can have ARI64_P_BITS = 16 bits instead of 12.  A
+// bit that the model is nearly certain of then costs as little as
+// 1/65536 instead of 1/4096 of the range, which adds up on highly
+// redundant data.
+//
+// Carries are handled as in the 32-bit encoder except that the low
+// register has no room for the carry bit, so it is kept in a separate
+// flag.  There can be no second carry before the next flush since the
+// interval never grows.
+//
+// As in the 32-bit encoder the first outputted word is always zero
+// and is ignored by the decoder.
+//
+// See also: the decoder in "rc64_decoder.hpp".
+
+#ifndef RC64_ENCODER_HPP
+#define RC64_ENCODER_HPP
+
+#include "config.hpp"
+
+#include "utility.hpp"
+
+class Encoder64
+{
+    FILE * codeFile;
+    U64 low;
+    U64 range;
+    U32 carry;
+    U32 fluxLen;
+    U32 fluxFst;
+public:
+    static const U32 P_BITS = ARI64_P_BITS;
+
+    Encoder64(FILE * codeFile)
+        : codeFile(codeFile),
+          low(0),
+          range(~(U64)0),
+          carry(0),
+          fluxLen(1),
+          fluxFst(0) {}
+
+    template <bool bit> void Encode(U32 p1)
+    {
+        assert(0 < p1 && p1 < ARI64_P_SCALE);
+        U64 mid = (range >> ARI64_P_BITS) * p1;
+        if (bit)
+            range = mid;
+        else
+        {
+            carry |= low + mid < low;
+            low += mid, range -= mid;
+        }
+    }
+
+    // A single shift is always enough since the range is at least
+    // 2^16 after coding a bit.
+    void Normalize()
+    {
+        if (range <= 0xFFFFFFFF)
+        {
+            U32 hi32 = low >> 32;
+            if (hi32 != 0xFFFFFFFF || carry)
+            {
+                PutU32(fluxFst + carry, codeFile);
+                while (--fluxLen)
+                    PutU32(0xFFFFFFFF + carry, codeFile);
+                fluxFst = hi32;
+                carry = 0;
+            }
+            ++fluxLen;
+            low <<= 32;
+            range <<= 32;
+        }
+    }
+
+    void FlushBuffer()
+    {
+        PutU32(fluxFst + carry, codeFile);
+        while (--fluxLen)
+            PutU32(0xFFFFFFFF + carry, codeFile);
+        PutU32(low >> 32, codeFile);
+        PutU32(low >>  0, codeFile);
+    }
+};
+#endif
@@ -13,6 +13,8 @@ class Decoder
     U32 range;
     U32 cml; // code minus low
 public:
+    static const U32 P_BITS = ARI_P_BITS;
+
     Decoder(FILE * codeFile)
         : codeFile(codeFile),
           range(0xFFFFFFFF),
@@ -23,6 +23,8 @@ class Encoder
     U32 fluxLen;
     U8  fluxFst;
 public:
+    static const U32 P_BITS = ARI_P_BITS;
+
     Encoder(FILE * codeFile)
         : codeFile(codeFile),
           low(0),
@@ -0,0 +1,122 @@
+// MODEL SNAPSHOTS
+//
+// Priming a model with a large dictionary takes as long as
+// compressing the dictionary would.  Instead the primed model can be
+// saved once with
+//
+// > crook p DICTIONARY SNAPSHOT
+//
+// and the snapshot passed with -D in place of the dictionary.  Since
+// all pointers in the pool are offsets (on 64-bit systems) the pool
+// can be mapped straight from the file, so starting up costs next to
+// nothing and pages are read in only as the model touches them.
+//
+// A snapshot starts with a header of SNAPSHOT_ALIGN bytes: the magic
+// string, the hash of the dictionary it was primed with and then
+// whatever small state the models choose to save.  It's followed by
+// the node pools, each starting at a multiple of SNAPSHOT_ALIGN so it
+// can be mapped on any page size.
+//
+// Everything is stored in native byte order; snapshots are meant to
+// be made on the machine that uses them.
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "config.hpp"
+
+#include "memory.hpp"
+
+#include <cstring>
+
+const char SNAPSHOT_MAGIC[8] = { 'c', 'r', 'o', 'o', 'k', 'S', 'N', '1' };
+
+class Snapshot
+{
+    FILE * file;
+    U8 header[SNAPSHOT_ALIGN];
+    U32 pos;  // position in the header
+    U64 next; // file offset of the next pool
+
+    void Put(const void * data, U32 size)
+    {
+        assert(pos + size <= SNAPSHOT_ALIGN);
+        memcpy(header + pos, data, size);
+        pos += size;
+    }
+
+    void Get(void * data, U32 size)
+    {
+        assert(pos + size <= SNAPSHOT_ALIGN);
+        memcpy(data, header + pos, size);
+        pos += size;
+    }
+public:
+    Snapshot() : file(NULL), pos(0), next(SNAPSHOT_ALIGN) {}
+
+    // WRITING
+
+    void Create(FILE * snapshotFile, U32 hash)
+    {
+        file = snapshotFile;
+        memset(header, 0, sizeof header);
+        pos = 0;
+        Put(SNAPSHOT_MAGIC, sizeof SNAPSHOT_MAGIC);
+        PutU32(hash);
+    }
+
+    void PutU32(U32 x) { Put(&x, sizeof x); }
+    void PutU64(U64 x) { Put(&x, sizeof x); }
+
+    void PutPool(const void * data, U64 size)
+    {
+        PutU64(next);
+        PutU64(size);
+        fseek(file, next, SEEK_SET);
+        fwrite(data, 1, size, file);
+        next = (next + size + SNAPSHOT_ALIGN - 1) & ~(U64)(SNAPSHOT_ALIGN - 1);
+    }
+
+    void Finish()
+    {
+        fseek(file, 0, SEEK_SET);
+        fwrite(header, 1, sizeof header, file);
+    }
+
+    // READING
+
+    // Returns false (and rewinds) if the file isn't a snapshot.
+    bool Open(FILE * snapshotFile)
+    {
+        file = snapshotFile;
+        pos = 0;
+        char magic[sizeof SNAPSHOT_MAGIC];
+        fseek(file, 0, SEEK_SET);
+        if (fread(header, 1, sizeof header, file) != sizeof header)
+        {
+            fseek(file, 0, SEEK_SET);
+            return false;
+        }
+        Get(magic, sizeof magic);
+        if (memcmp(magic, SNAPSHOT_MAGIC, sizeof magic) != 0)
+        {
+            fseek(file, 0, SEEK_SET);
+            return false;
+        }
+        return true;
+    }
+
+    U32 GetU32() { U32 x; Get(&x, sizeof x); return x; }
+    U64 GetU64() { U64 x; Get(&x, sizeof x); return x; }
+
+    // Maps the next pool over the memory at addr which has room for
+    // capacity bytes.  Returns false if it doesn't fit or on failure.
+    bool MapPool(void * addr, U64 capacity, U64 & size)
+    {
+        U64 offset = GetU64();
+        size = GetU64();
+        return size <= capacity && MapFile(addr, size, fileno(file), offset);
+    }
+};
+
+#endif
@@ -0,0 +1,211 @@
+// CODING STATISTICS
+//
+// With -v a breakdown of how each file was coded is printed once it's
+// done, to help choose -O and -m for a kind of data:
+//
+// - for every bitwise order of the active node, how many bits were
+//   coded there and how many bits of code they took;
+// - how many suffix steps each update of the tree took;
+// - how many nodes were created per MiB of input;
+// - how far into the input the pool filled up, if it did.
+//
+// The bits are counted by the kernels in "kernel.hpp" and for the
+// order-1/2 tables by a BitCounter, see below; a table's order is its
+// context's bytes and the bits of the current one.  The tables have no
+// nodes and no pool, so only the tree prints the last three.  The
+// bytewise model codes decisions rather than bits and gets a table of
+// its own, by the order of the context they were made in, -1 below
+// order 0, followed by the contexts it created.  With -o the steps and
+// the nodes of both models are counted, with -b2 the code of both
+// engines, including the one thrown away.  The point where the pool
+// filled is only known with a single lane.
+//
+// The counters are reached through a thread-local pointer that's NULL
+// without -v, so each worker of -j counts its own file and the hot
+// paths only pay for a test of the pointer.
+
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include "config.hpp"
+
+#include "utility.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// -log2(p) for ARI64_P_BITS probabilities, the most precise any coder
+// codes with, so that a coder's probabilities are costed exactly
+class CostTable
+{
+    float t[ARI64_P_SCALE];
+public:
+    CostTable()
+    {
+        t[0] = ARI64_P_BITS + 1; // never coded, but Fit may round down to 0
+        for (U32 p = 1; p < ARI64_P_SCALE; ++p)
+            t[p] = -log2((double)p / ARI64_P_SCALE);
+    }
+    float operator[](U32 p)
+    {
+        assert(p < ARI64_P_SCALE);
+        return t[p];
+    }
+} cost;
+
+// Bits of code for a bit whose 1 had probability p1 with pBits of
+// precision, at most ARI64_P_BITS.
+inline float Cost(U32 p1, U32 pBits, U32 bit)
+{
+    U32 p = Fit(p1, pBits, ARI64_P_BITS);
+    return cost[bit ? p : min(ARI64_P_SCALE - p, ARI64_P_SCALE - 1)];
+}
+
+struct Statistics
+{
+    vector<U64> bits;     // bits coded at each bitwise order
+    vector<double> spent; // bits of code spent on them
+    vector<U64> decisions; // of the bytewise model at each order + 1
+    vector<double> decided; // bits of code spent on them
+    U64 walks[STATS_WALK_LIMIT]; // updates by suffix steps, the last
+                                 // one counting all longer walks too
+    U64 created;
+    U64 contexts;         // created by the bytewise model
+    U64 filledAt;         // bytes before the pool filled
+    bool filled;
+
+    Statistics() : created(0), contexts(0), filledAt(0), filled(false)
+    {
+        fill(walks, walks + STATS_WALK_LIMIT, 0);
+    }
+
+    // p1 is the probability of a 1 with pBits of precision.
+    void Bit(int order, U32 p1, U32 pBits, U32 bit)
+    {
+        if ((U32)order >= bits.size())
+        {
+            bits.resize(order + 1);
+            spent.resize(order + 1);
+        }
+        ++bits[order];
+        spent[order] += Cost(p1, pBits, bit);
+    }
+
+    // A decision of the bytewise model in a context of the order, or -1.
+    void Decision(int order, U32 p1, U32 pBits, U32 bit)
+    {
+        if ((U32)order + 1 >= decisions.size())
+        {
+            decisions.resize(order + 2);
+            decided.resize(order + 2);
+        }
+        ++decisions[order + 1];
+        decided[order + 1] += Cost(p1, pBits, bit);
+    }
+
+    void Walk(U32 steps)
+    {
+        ++walks[min(steps, STATS_WALK_LIMIT - 1)];
+    }
+
+    void Created()
+    {
+        ++created;
+    }
+
+    void ContextCreated()
+    {
+        ++contexts;
+    }
+
+    void Filled(U64 processed)
+    {
+        if (!filled)
+            filledAt = processed, filled = true;
+    }
+
+    void Print(const char * name)
+    {
+        U64 totalBits = 0;
+        double totalSpent = 0;
+        for (size_t i = 0; i != bits.size(); ++i)
+            totalBits += bits[i], totalSpent += spent[i];
+        U64 totalDecisions = 0;
+        double totalDecided = 0;
+        for (size_t i = 0; i != decisions.size(); ++i)
+            totalDecisions += decisions[i], totalDecided += decided[i];
+        U64 totalWalks = 0;
+        for (U32 i = 0; i != STATS_WALK_LIMIT; ++i)
+            totalWalks += walks[i];
+        double mib = totalBits / 8.0 / (1 << 20);
+
+        fprintf(stderr, "%s: coding statistics\n", name);
+        if (totalBits != 0)
+        {
+            fprintf(stderr, "  order      bits  share    code bits  share  per bit\n");
+            for (size_t i = 0; i != bits.size(); ++i)
+            {
+                if (bits[i] == 0)
+                    continue;
+                fprintf(stderr, "  %2d.%d %11llu %5.1f%% %12.0f %5.1f%% %8.4f\n",
+                        (int)i / 8, (int)i % 8, (unsigned long long)bits[i],
+                        100.0 * bits[i] / totalBits, spent[i],
+                        100.0 * spent[i] / max(totalSpent, 1.0),
+                        spent[i] / bits[i]);
+            }
+        }
+        if (totalDecisions != 0)
+        {
+            fprintf(stderr, "  order  decisions  share    code bits  share  per decision\n");
+            for (size_t i = 0; i != decisions.size(); ++i)
+            {
+                if (decisions[i] == 0)
+                    continue;
+                fprintf(stderr, "  %5d %10llu %5.1f%% %12.0f %5.1f%% %13.4f\n",
+                        (int)i - 1, (unsigned long long)decisions[i],
+                        100.0 * decisions[i] / totalDecisions, decided[i],
+                        100.0 * decided[i] / max(totalDecided, 1.0),
+                        decided[i] / decisions[i]);
+            }
+            fprintf(stderr, "  contexts created: %llu\n",
+                    (unsigned long long)contexts);
+        }
+        // only the tree walks, the other engines have nothing more
+        if (totalWalks == 0)
+            return;
+        fprintf(stderr, "  suffix steps per update:");
+        for (U32 i = 0; i != STATS_WALK_LIMIT; ++i)
+        {
+            if (walks[i] != 0)
+                fprintf(stderr, " %u%s %.2f%%", i,
+                        i == STATS_WALK_LIMIT - 1 ? "+:" : ":",
+                        100.0 * walks[i] / totalWalks);
+        }
+        fprintf(stderr, "\n");
+        fprintf(stderr, "  nodes created: %llu", (unsigned long long)created);
+        if (mib > 0)
+            fprintf(stderr, ", %.0f per MiB", created / mib);
+        fprintf(stderr, "\n");
+        if (filled)
+            fprintf(stderr, "  pool filled after %.2f MiB of input\n",
+                    filledAt / (double)(1 << 20));
+        else
+            fprintf(stderr, "  pool never filled\n");
+    }
+};
+
+__thread Statistics * statistics = NULL; // this thread's, or NULL
+
+// The kernels of most models count their bits as they code them.  A
+// model whose kernels can't afford to, see "direct.hpp", specializes
+// this: it's made before a block is coded and counts the block after.
+template <class Coder, class Model> class BitCounter
+{
+public:
+    BitCounter(Model &) {}
+
+    void Count(const U8 *, U32) {}
+};
+
+#endif
@@ -0,0 +1,93 @@
+// THE MEMORY TIMELINE
+//
+// With -tN compressing a file also writes OUTPUT.timeline, a CSV file
+// with a line for every N KiB of input:
+//
+// > offset,used_bytes,order,code_bytes,full
+// > 0,4096,0,6,0
+// > 1048576,73400320,3,247301,0
+//
+// - used_bytes: the memory the model is using, for the tree the nodes
+//   from the bottom of the pool up to top
+// - order:      the order of the active context in bytes
+// - code_bytes: the length of the compressed file so far
+// - full:       1 once the pool is full and the model frozen
+//
+// Plotting used_bytes against offset shows how fast a kind of data
+// fills the pool and so where it would freeze with a given -m, which
+// is what -m should be chosen by.
+//
+// The code is collected a block at a time in memory (see "blocks.hpp")
+// so code_bytes is the file so far plus what the coder has produced of
+// the current block, a few bytes short of the final count, or the code
+// that's thrown away if the block ends up trained.  With -b2
+// the block is coded twice and the first, the tree, is what's sampled.
+// Like the cost map the timeline needs a single lane, so -t can't be
+// used with -i.
+
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include "config.hpp"
+
+#include <algorithm>
+
+class Timeline
+{
+    FILE * file;
+    U64 interval; // between samples, in bytes
+    U64 next;     // offset of the next sample
+    U64 base;     // code written before the current block
+    FILE * stream; // the current block's code, or NULL
+
+    void Sample(U64 position, U64 used, int order, U64 code, bool full)
+    {
+        fprintf(file, "%llu,%llu,%d,%llu,%d\n", (unsigned long long)position,
+                (unsigned long long)used, order, (unsigned long long)code,
+                full);
+        next = position - position % interval + interval;
+    }
+public:
+    Timeline(FILE * file, U64 interval)
+        : file(file), interval(interval), next(0), base(0), stream(NULL)
+    {
+        fprintf(file, "offset,used_bytes,order,code_bytes,full\n");
+    }
+
+    // A block starts with base bytes of code written before it.
+    void Block(U64 codeLength)
+    {
+        base = codeLength;
+    }
+
+    // The block's code goes to stream, or nowhere for NULL.
+    void Code(FILE * codeStream)
+    {
+        stream = codeStream;
+    }
+
+    // Called before every byte that's coded.
+    template <class Model> void Byte(U64 position, Model & model)
+    {
+        if (position < next)
+            return;
+        U64 code = base + (stream != NULL ? ftell(stream) : 0);
+        Sample(position, model.GetUsedBytes(), model.GetOrder() / 8, code,
+               model.IsFull());
+    }
+
+    // A block of length bytes stored as it is, after a byte of type.
+    template <class Model> void Raw(U64 position, U32 length, Model & model)
+    {
+        while (next < position + length)
+        {
+            U64 at = max(next, position);
+            Sample(at, model.GetUsedBytes(), model.GetOrder() / 8,
+                   base + 1 + (at - position), model.IsFull());
+        }
+    }
+};
+
+__thread Timeline * timeline = NULL; // this thread's, or NULL
+
+#endif
@@ -4,6 +4,8 @@
 // probability then Fit(x, n, m) is the closest m-bit probability.
 //
 // Fit0 is similar but it ensures the result does not become zero.
+//
+// PutU32 and GetU32 write and read 32-bit big-endian integers.
 
 #ifndef UTILITY_HPP
 #define UTILITY_HPP
@@ -22,4 +24,22 @@ U32 Fit0(U32 x, U32 n, U32 m)
     return Fit(x, n, m) + 1 - (x >> (n - 1));
 }
 
+void PutU32(U32 x, FILE * file)
+{
+    putc(x >> 24, file);
+    putc(x >> 16, file);
+    putc(x >>  8, file);
+    putc(x >>  0, file);
+}
+
+U32 GetU32(FILE * file)
+{
+    U32 x = 0;
+    x += getc(file) << 24;
+    x += getc(file) << 16;
+    x += getc(file) <<  8;
+    x += getc(file) <<  0;
+    return x;
+}
+
 #endif